@@ -0,0 +1,321 @@
+//===----------------------------------------------------------------------===//
+/// Generate synthetic inputs of a given size for the plugin benchmarks:
+/// \code
+/// bench-corpus-gen -kind=mul -size=100000 -o mul.bc
+/// bench-corpus-gen -kind=halt -size=1000 -depth=64 -o halt.bc
+/// bench-corpus-gen -kind=alias -size=1000 -o alias.bc
+/// bench-corpus-gen -kind=ternary -size=1000 -o ternary.c
+/// \endcode
+/// The output only depends on the options, including -seed.
+//===----------------------------------------------------------------------===//
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <random>
+
+using namespace llvm;
+
+enum CorpusKind { CK_Mul, CK_Halt, CK_Alias, CK_Ternary };
+static cl::opt<CorpusKind> Kind(
+    "kind", cl::Required, cl::desc("Kind of corpus"),
+    cl::values(
+        clEnumValN(CK_Mul, "mul", "Multiplications by constants, for "
+                                  "SimpleMulOpt"),
+        clEnumValN(CK_Halt, "halt", "Nested branches into my_halt, for "
+                                    "HaltAnalyzer"),
+        clEnumValN(CK_Alias, "alias", "Loops over pointer arguments, for "
+                                      "StrictOpt"),
+        clEnumValN(CK_Ternary, "ternary", "C functions with if/else that "
+                                          "can be ternaries, for "
+                                          "TernaryConverter")));
+
+static cl::opt<unsigned>
+    Size("size", cl::init(1000),
+         cl::desc("Number of multiplications for 'mul', number of "
+                  "functions for the other kinds"));
+
+static cl::opt<unsigned>
+    Depth("depth", cl::init(16),
+          cl::desc("Nesting depth of the branches in 'halt' and 'ternary'"));
+
+static cl::opt<unsigned>
+    MulsPerFunction("muls-per-function", cl::init(1000),
+                    cl::desc("Maximum number of multiplications in each "
+                             "function of 'mul'"));
+
+static cl::opt<unsigned> Seed("seed", cl::init(1),
+                              cl::desc("Seed of the random constants"));
+
+static cl::opt<bool> EmitText("S", cl::init(false),
+                              cl::desc("Write textual IR instead of bitcode"));
+
+static cl::opt<std::string> OutputFile("o", cl::init("-"),
+                                       cl::desc("Output file"),
+                                       cl::value_desc("filename"));
+
+static std::mt19937_64 RNG;
+
+static uint64_t randomBelow(uint64_t Bound) {
+  return std::uniform_int_distribution<uint64_t>(0, Bound - 1)(RNG);
+}
+
+/// Constants in the proportions seen in real code: powers of two, their
+/// neighbours, small odd numbers and arbitrary ones.
+static uint64_t randomMulConstant() {
+  unsigned Shift = 1 + randomBelow(62);
+  switch (randomBelow(4)) {
+  case 0:
+    return 1ULL << Shift;
+  case 1:
+    return (1ULL << Shift) + (randomBelow(2) ? 1 : -1);
+  case 2:
+    return 3 + 2 * randomBelow(127);
+  default:
+    return RNG();
+  }
+}
+
+/// Functions of at most -muls-per-function dependent multiplications,
+/// interleaved with additions so that none of them can be folded.
+static void generateMul(Module &M) {
+  auto &Ctx = M.getContext();
+  auto *I64 = Type::getInt64Ty(Ctx);
+  auto *FTy = FunctionType::get(I64, {I64, I64}, false);
+
+  for (unsigned Done = 0, Idx = 0; Done < Size; ++Idx) {
+    auto *F = Function::Create(FTy, Function::ExternalLinkage,
+                               "mul_chain_" + Twine(Idx), M);
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", F));
+    Value *V = F->getArg(0), *Addend = F->getArg(1);
+    for (unsigned N = std::min<unsigned>(MulsPerFunction, Size - Done);
+         N; --N, ++Done) {
+      V = Builder.CreateMul(V, Builder.getInt64(randomMulConstant()));
+      V = Builder.CreateAdd(V, Addend);
+    }
+    Builder.CreateRet(V);
+  }
+}
+
+/// Every function is a chain of -depth nested ifs. Each level either
+/// returns, or calls my_halt and keeps running code that is dead, either
+/// directly or through one of the `fatal` wrappers that HaltPropagation
+/// has to find first.
+static void generateHalt(Module &M) {
+  auto &Ctx = M.getContext();
+  auto *I32 = Type::getInt32Ty(Ctx);
+  auto *VoidTy = Type::getVoidTy(Ctx);
+  auto *HaltTy = FunctionType::get(VoidTy, {I32}, false);
+  FunctionCallee MyHalt = M.getOrInsertFunction("my_halt", HaltTy);
+
+  SmallVector<Function *, 8> Fatals;
+  for (unsigned I = 0; I < std::max(Size / 16, 1U); ++I) {
+    auto *F = Function::Create(HaltTy, Function::InternalLinkage,
+                               "fatal_" + Twine(I), M);
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", F));
+    Builder.CreateCall(MyHalt, {F->getArg(0)});
+    Builder.CreateRetVoid();
+    Fatals.push_back(F);
+  }
+
+  auto *FTy = FunctionType::get(I32, {I32, I32}, false);
+  for (unsigned I = 0; I < Size; ++I) {
+    auto *F = Function::Create(FTy, Function::ExternalLinkage,
+                               "nested_" + Twine(I), M);
+    Value *X = F->getArg(0), *Y = F->getArg(1);
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", F));
+    Value *Acc = Y;
+    for (unsigned Level = 0; Level < Depth; ++Level) {
+      auto *Leaf = BasicBlock::Create(Ctx, "leaf", F);
+      auto *Next = BasicBlock::Create(Ctx, "level", F);
+      Value *Bit = Builder.CreateAnd(X, Builder.getInt32(1U << (Level % 31)));
+      Builder.CreateCondBr(Builder.CreateICmpNE(Bit, Builder.getInt32(0)),
+                           Leaf, Next);
+
+      Builder.SetInsertPoint(Leaf);
+      Value *Ret = Builder.CreateMul(Acc, Builder.getInt32(Level + 3));
+      switch (randomBelow(3)) {
+      case 0:
+        Builder.CreateCall(MyHalt, {Ret});
+        break;
+      case 1:
+        Builder.CreateCall(Fatals[randomBelow(Fatals.size())], {Ret});
+        break;
+      default:
+        break;
+      }
+      // Dead code if there was a halting call above
+      auto *Tail = BasicBlock::Create(Ctx, "tail", F);
+      Builder.CreateBr(Tail);
+      Builder.SetInsertPoint(Tail);
+      Builder.CreateRet(Builder.CreateXor(Ret, X));
+
+      Builder.SetInsertPoint(Next);
+      Acc = Builder.CreateAdd(Acc, Builder.getInt32(Level));
+    }
+    Builder.CreateRet(Acc);
+  }
+}
+
+/// Loops over three pointer arguments. Kernels with an even index are only
+/// called with distinct allocas, which StrictOptIPO proves noalias; odd
+/// ones are called with arbitrary pointers, which need multiversioning.
+static void generateAlias(Module &M) {
+  auto &Ctx = M.getContext();
+  auto *FloatTy = Type::getFloatTy(Ctx);
+  auto *PtrTy = FloatTy->getPointerTo();
+  auto *I64 = Type::getInt64Ty(Ctx);
+  auto *VoidTy = Type::getVoidTy(Ctx);
+  const unsigned ArrayLen = 256;
+  auto *ArrayTy = ArrayType::get(FloatTy, ArrayLen);
+
+  auto *KernelTy = FunctionType::get(VoidTy, {PtrTy, PtrTy, PtrTy, I64},
+                                     false);
+  for (unsigned I = 0; I < Size; ++I) {
+    // a[i] = b[i] * c[i] + a[i]
+    auto *Kernel = Function::Create(KernelTy, Function::InternalLinkage,
+                                    "kernel_" + Twine(I), M);
+    Value *A = Kernel->getArg(0), *B = Kernel->getArg(1),
+          *C = Kernel->getArg(2), *N = Kernel->getArg(3);
+    auto *Entry = BasicBlock::Create(Ctx, "entry", Kernel);
+    auto *Loop = BasicBlock::Create(Ctx, "loop", Kernel);
+    auto *Exit = BasicBlock::Create(Ctx, "exit", Kernel);
+    IRBuilder<> Builder(Entry);
+    Builder.CreateCondBr(Builder.CreateICmpSGT(N, Builder.getInt64(0)), Loop,
+                         Exit);
+    Builder.SetInsertPoint(Loop);
+    PHINode *IV = Builder.CreatePHI(I64, 2, "iv");
+    IV->addIncoming(Builder.getInt64(0), Entry);
+    auto *PA = Builder.CreateInBoundsGEP(FloatTy, A, IV);
+    auto *PB = Builder.CreateInBoundsGEP(FloatTy, B, IV);
+    auto *PC = Builder.CreateInBoundsGEP(FloatTy, C, IV);
+    Value *Prod = Builder.CreateFMul(Builder.CreateLoad(FloatTy, PB),
+                                     Builder.CreateLoad(FloatTy, PC));
+    Builder.CreateStore(Builder.CreateFAdd(Prod,
+                                           Builder.CreateLoad(FloatTy, PA)),
+                        PA);
+    Value *Next = Builder.CreateAdd(IV, Builder.getInt64(1), "iv.next",
+                                    /*HasNUW=*/true, /*HasNSW=*/true);
+    IV->addIncoming(Next, Loop);
+    Builder.CreateCondBr(Builder.CreateICmpSLT(Next, N), Loop, Exit);
+    Builder.SetInsertPoint(Exit);
+    Builder.CreateRetVoid();
+
+    if (I % 2) {
+      auto *CallerTy = FunctionType::get(VoidTy, {PtrTy, PtrTy, PtrTy, I64},
+                                         false);
+      auto *Caller = Function::Create(CallerTy, Function::ExternalLinkage,
+                                      "call_kernel_" + Twine(I), M);
+      IRBuilder<> CB(BasicBlock::Create(Ctx, "entry", Caller));
+      CB.CreateCall(Kernel, {Caller->getArg(0), Caller->getArg(1),
+                             Caller->getArg(2), Caller->getArg(3)});
+      CB.CreateRetVoid();
+      continue;
+    }
+
+    auto *CallerTy = FunctionType::get(FloatTy, {I64}, false);
+    auto *Caller = Function::Create(CallerTy, Function::ExternalLinkage,
+                                    "call_kernel_" + Twine(I), M);
+    IRBuilder<> CB(BasicBlock::Create(Ctx, "entry", Caller));
+    SmallVector<Value *, 3> Arrays;
+    for (unsigned J = 0; J < 3; ++J) {
+      auto *Array = CB.CreateAlloca(ArrayTy);
+      Arrays.push_back(CB.CreateConstInBoundsGEP2_64(ArrayTy, Array, 0, 0));
+    }
+    Value *Len = CB.CreateSelect(
+        CB.CreateICmpULT(Caller->getArg(0), CB.getInt64(ArrayLen)),
+        Caller->getArg(0), CB.getInt64(ArrayLen));
+    CB.CreateCall(Kernel, {Arrays[0], Arrays[1], Arrays[2], Len});
+    CB.CreateRet(CB.CreateLoad(FloatTy, Arrays[0]));
+  }
+}
+
+/// C functions whose nested if/else statements either assign the same
+/// variable or return in both branches.
+static void generateTernary(raw_ostream &OS) {
+  OS << "/* Generated by bench-corpus-gen -kind=ternary -size=" << Size
+     << " -depth=" << Depth << " -seed=" << Seed << " */\n";
+  for (unsigned I = 0; I < Size; ++I) {
+    OS << "int ternary_" << I << "(int c, int a, int b) {\n"
+       << "  int x = 0;\n";
+    for (unsigned Level = 0; Level < Depth; ++Level) {
+      std::string Indent(2 * (Level + 1), ' ');
+      OS << Indent << "if (c & " << (1U << (Level % 31)) << ")\n"
+         << Indent << "  x = a + " << randomBelow(100) << ";\n"
+         << Indent << "else\n"
+         << Indent << "  x = b - " << randomBelow(100) << ";\n"
+         << Indent << "if (c > " << randomBelow(1000) << ") {\n";
+    }
+    std::string Indent(2 * (Depth + 1), ' ');
+    OS << Indent << "if (x > a)\n"
+       << Indent << "  return x;\n"
+       << Indent << "else\n"
+       << Indent << "  return a;\n";
+    for (unsigned Level = Depth; Level > 0; --Level)
+      OS << std::string(2 * Level, ' ') << "}\n";
+    OS << "  return x;\n"
+       << "}\n\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Plugin benchmark corpus "
+                                          "generator\n");
+  RNG.seed(Seed);
+
+  std::error_code EC;
+  bool IsText = EmitText || Kind == CK_Ternary;
+  ToolOutputFile Out(OutputFile, EC,
+                     IsText ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC) {
+    WithColor::error() << "failed to open " << OutputFile << ": "
+                       << EC.message() << "\n";
+    return 1;
+  }
+
+  if (Kind == CK_Ternary) {
+    generateTernary(Out.os());
+    Out.keep();
+    return 0;
+  }
+
+  LLVMContext Ctx;
+  Module M("corpus", Ctx);
+  switch (Kind) {
+  case CK_Mul:
+    generateMul(M);
+    break;
+  case CK_Halt:
+    generateHalt(M);
+    break;
+  case CK_Alias:
+    generateAlias(M);
+    break;
+  default:
+    llvm_unreachable("handled above");
+  }
+
+  if (verifyModule(M, &errs())) {
+    WithColor::error() << "generated an invalid module\n";
+    return 1;
+  }
+  if (EmitText)
+    M.print(Out.os(), nullptr);
+  else
+    WriteBitcodeToFile(M, Out.os());
+  Out.keep();
+  return 0;
+}
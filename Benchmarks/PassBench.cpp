@@ -0,0 +1,312 @@
+//===----------------------------------------------------------------------===//
+/// Time every pass and analysis of a pipeline, like -time-passes, and
+/// report them with the peak RSS of the process as JSON:
+/// \code
+/// bench-passes -load-pass-plugin=libSimpleMulOpt.so
+///              -passes='function(simple-mul-opt)' -repeat=5 mul.bc
+/// \endcode
+/// The times are exclusive: a pass manager or an adaptor is not charged
+/// for the passes it runs, and a pass is not charged for the analyses it
+/// requests. They are averaged over the repetitions, each of which
+/// optimizes a freshly parsed module. The pipeline is built for the
+/// target of the module, or the host if it has none, so that `default<O3>`
+/// sees the same target information as in clang.
+//===----------------------------------------------------------------------===//
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFile(cl::Positional, cl::Required,
+                                      cl::desc("<.bc or .ll file>"));
+
+// Loaded before the command line is parsed, see loadPassPlugins
+static cl::list<std::string>
+    PassPlugins("load-pass-plugin",
+                cl::desc("Load passes from plugin library"));
+
+static cl::opt<std::string>
+    PassPipeline("passes", cl::Required,
+                 cl::desc("Pipeline to run, in the syntax of opt -passes"));
+
+static cl::opt<unsigned>
+    NumRepeats("repeat", cl::init(5),
+               cl::desc("Number of times the pipeline is run"));
+
+static cl::opt<std::string> OutputFile("o", cl::init("-"),
+                                       cl::desc("Output JSON file"),
+                                       cl::value_desc("filename"));
+
+using Clock = std::chrono::steady_clock;
+
+static double toMillis(Clock::duration D) {
+  return std::chrono::duration<double, std::milli>(D).count();
+}
+
+/// Peak resident set size of this process, in KiB
+static uint64_t getPeakRSS() {
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage))
+    return 0;
+#ifdef __APPLE__
+  // In bytes instead of KiB
+  return Usage.ru_maxrss / 1024;
+#else
+  return Usage.ru_maxrss;
+#endif
+}
+
+namespace {
+struct PassStats {
+  bool IsAnalysis = false;
+  uint64_t NumRuns = 0;
+  Clock::duration Time{0};
+};
+
+/// Charge the time between the before and after callbacks of a pass, or
+/// an analysis, minus the time of what runs nested in it.
+class PassTimer {
+  struct Frame {
+    StringRef Name;
+    bool IsAnalysis;
+    Clock::time_point Start;
+    Clock::duration Nested;
+  };
+  SmallVector<Frame, 8> Stack;
+
+  void push(StringRef Name, bool IsAnalysis) {
+    Stack.push_back({Name, IsAnalysis, Clock::now(), Clock::duration(0)});
+  }
+
+  void pop() {
+    Frame F = Stack.pop_back_val();
+    auto Elapsed = Clock::now() - F.Start;
+    auto &S = Stats[F.Name];
+    S.IsAnalysis = F.IsAnalysis;
+    ++S.NumRuns;
+    S.Time += Elapsed - F.Nested;
+    if (!Stack.empty())
+      Stack.back().Nested += Elapsed;
+  }
+
+public:
+  StringMap<PassStats> Stats;
+
+  void registerCallbacks(PassInstrumentationCallbacks &PIC) {
+    PIC.registerBeforeNonSkippedPassCallback(
+        [this](StringRef P, Any) { push(P, /*IsAnalysis=*/false); });
+    PIC.registerAfterPassCallback(
+        [this](StringRef, Any, const PreservedAnalyses &) { pop(); });
+    PIC.registerAfterPassInvalidatedCallback(
+        [this](StringRef, const PreservedAnalyses &) { pop(); });
+    PIC.registerBeforeAnalysisCallback(
+        [this](StringRef P, Any) { push(P, /*IsAnalysis=*/true); });
+    PIC.registerAfterAnalysisCallback([this](StringRef, Any) { pop(); });
+  }
+};
+} // end anonymous namespace
+
+/// Load the -load-pass-plugin libraries ahead of
+/// cl::ParseCommandLineOptions, which would otherwise reject the options
+/// the plugins register.
+static bool loadPassPlugins(int argc, char **argv,
+                            std::vector<PassPlugin> &Plugins) {
+  for (int I = 1; I < argc; ++I) {
+    StringRef Arg(argv[I]);
+    if (!Arg.consume_front("-load-pass-plugin") &&
+        !Arg.consume_front("--load-pass-plugin"))
+      continue;
+    std::string Path;
+    if (Arg.consume_front("="))
+      Path = Arg.str();
+    else if (Arg.empty() && I + 1 < argc)
+      Path = argv[++I];
+    else
+      continue;
+
+    auto PluginOrErr = PassPlugin::Load(Path);
+    if (!PluginOrErr) {
+      WithColor::error(errs(), "bench-passes")
+          << "failed to load plugin " << Path << ": "
+          << toString(PluginOrErr.takeError()) << "\n";
+      return false;
+    }
+    Plugins.push_back(*PluginOrErr);
+  }
+  return true;
+}
+
+/// Target of \p M, or of the host if it has none, like the generated
+/// corpus. Null if the target isn't built in.
+static std::unique_ptr<TargetMachine> createTargetMachine(const Module &M) {
+  std::string TT = M.getTargetTriple();
+  if (TT.empty())
+    TT = sys::getDefaultTargetTriple();
+  std::string Err;
+  const Target *T = TargetRegistry::lookupTarget(TT, Err);
+  if (!T) {
+    WithColor::warning(errs(), "bench-passes")
+        << "no target information: " << Err << "\n";
+    return nullptr;
+  }
+  return std::unique_ptr<TargetMachine>(
+      T->createTargetMachine(TT, /*CPU=*/"", /*Features=*/"",
+                             TargetOptions(), /*RM=*/None));
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeAllTargetInfos();
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+
+  std::vector<PassPlugin> Plugins;
+  if (!loadPassPlugins(argc, argv, Plugins))
+    return 1;
+  cl::ParseCommandLineOptions(argc, argv, "Pass pipeline benchmark\n");
+
+  PassTimer Timer;
+  PassInstrumentationCallbacks PIC;
+  Timer.registerCallbacks(PIC);
+  // Built once the target is known, from the first parsed module
+  std::unique_ptr<TargetMachine> TM;
+  std::unique_ptr<PassBuilder> PB;
+  ModulePassManager MPM;
+
+  std::vector<double> ParseTimes, PipelineTimes;
+  uint64_t LoadedRSS = 0;
+  size_t NumFunctions = 0, NumInsts = 0;
+  for (unsigned Run = 0; Run < std::max(NumRepeats.getValue(), 1U); ++Run) {
+    LLVMContext Ctx;
+    SMDiagnostic Err;
+    auto ParseStart = Clock::now();
+    std::unique_ptr<Module> M = parseIRFile(InputFile, Err, Ctx);
+    if (!M) {
+      Err.print("bench-passes", errs());
+      return 1;
+    }
+    ParseTimes.push_back(toMillis(Clock::now() - ParseStart));
+
+    if (!PB) {
+      TM = createTargetMachine(*M);
+      PB = std::make_unique<PassBuilder>(/*DebugLogging=*/false, TM.get(),
+                                         PipelineTuningOptions(),
+                                         /*PGOOpt=*/None, &PIC);
+      for (const auto &Plugin : Plugins)
+        Plugin.registerPassBuilderCallbacks(*PB);
+      if (Error E = PB->parsePassPipeline(MPM, PassPipeline)) {
+        WithColor::error(errs(), "bench-passes")
+            << toString(std::move(E)) << "\n";
+        // Distinguished from the other failures, see run_benchmarks.py
+        return 2;
+      }
+    }
+    // Modules without a target get the host's, as clang would give them
+    if (TM && M->getTargetTriple().empty()) {
+      M->setTargetTriple(TM->getTargetTriple().str());
+      M->setDataLayout(TM->createDataLayout());
+    }
+
+    if (!Run) {
+      LoadedRSS = getPeakRSS();
+      for (const auto &F : *M) {
+        NumFunctions += !F.isDeclaration();
+        NumInsts += F.getInstructionCount();
+      }
+    }
+
+    // Nothing is cached from the previous runs
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PB->registerModuleAnalyses(MAM);
+    PB->registerCGSCCAnalyses(CGAM);
+    PB->registerFunctionAnalyses(FAM);
+    PB->registerLoopAnalyses(LAM);
+    PB->crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    auto Start = Clock::now();
+    MPM.run(*M, MAM);
+    PipelineTimes.push_back(toMillis(Clock::now() - Start));
+  }
+
+  std::vector<std::pair<StringRef, const PassStats *>> Passes;
+  for (const auto &Entry : Timer.Stats)
+    Passes.push_back({Entry.first(), &Entry.second});
+  llvm::sort(Passes, [](const auto &LHS, const auto &RHS) {
+    return LHS.second->Time > RHS.second->Time;
+  });
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error(errs(), "bench-passes")
+        << "failed to open " << OutputFile << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  auto Summarize = [](json::OStream &J, std::vector<double> Times) {
+    llvm::sort(Times);
+    J.object([&] {
+      J.attribute("min", Times.front());
+      J.attribute("median", Times[Times.size() / 2]);
+      J.attribute("max", Times.back());
+    });
+  };
+  double NumRuns = PipelineTimes.size();
+  json::OStream J(Out.os(), /*IndentSize=*/2);
+  J.object([&] {
+    J.attribute("input", InputFile);
+    J.attribute("pipeline", PassPipeline);
+    J.attribute("repeat", static_cast<int64_t>(NumRuns));
+    J.attribute("functions", static_cast<int64_t>(NumFunctions));
+    J.attribute("instructions", static_cast<int64_t>(NumInsts));
+    J.attributeBegin("parse_ms");
+    Summarize(J, ParseTimes);
+    J.attributeEnd();
+    J.attributeBegin("pipeline_ms");
+    Summarize(J, PipelineTimes);
+    J.attributeEnd();
+    J.attribute("loaded_rss_kib", static_cast<int64_t>(LoadedRSS));
+    J.attribute("peak_rss_kib", static_cast<int64_t>(getPeakRSS()));
+    J.attributeArray("passes", [&] {
+      for (const auto &P : Passes)
+        J.object([&] {
+          J.attribute("name", P.first);
+          J.attribute("analysis", P.second->IsAnalysis);
+          J.attribute("runs", P.second->NumRuns / NumRuns);
+          J.attribute("ms", toMillis(P.second->Time) / NumRuns);
+        });
+    });
+  });
+  Out.os() << "\n";
+  Out.keep();
+  return 0;
+}
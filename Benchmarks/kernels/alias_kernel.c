@@ -0,0 +1,52 @@
+/* Loops over pointer arguments that never alias, for StrictOpt. The
+ * arrays of run_local are distinct allocas, so StrictOptIPO can prove it;
+ * the globals passed to stencil need the runtime checks of
+ * multiversioning. */
+#include "bench_kernel.h"
+
+#define N 4096
+#define REPS 20000
+
+static float in_g[N + 2], out_g[N + 2];
+
+__attribute__((noinline))
+static void fma_loop(float *a, const float *b, const float *c, int n) {
+  for (int i = 0; i < n; ++i)
+    a[i] += b[i] * c[i];
+}
+
+__attribute__((noinline))
+static void stencil(float *out, const float *in, int n) {
+  for (int i = 1; i <= n; ++i)
+    out[i] = 0.25f * in[i - 1] + 0.5f * in[i] + 0.25f * in[i + 1];
+}
+
+__attribute__((noinline))
+static float run_local(int n, uint64_t seed) {
+  float a[N], b[N], c[N];
+  for (int i = 0; i < N; ++i) {
+    a[i] = (float)(bench_random(&seed) % 1000) / 1000.0f;
+    b[i] = (float)(bench_random(&seed) % 1000) / 1000.0f;
+    c[i] = (float)(bench_random(&seed) % 1000) / 1000.0f;
+  }
+  for (int r = 0; r < REPS; ++r)
+    fma_loop(a, b, c, n);
+  return a[0] + a[n / 2] + a[n - 1];
+}
+
+int main(void) {
+  uint64_t state = 88172645463325252ULL;
+  for (int i = 0; i < N + 2; ++i)
+    in_g[i] = (float)(bench_random(&state) % 1000) / 1000.0f;
+
+  int n = N;
+  BENCH_OPAQUE(n);
+  uint64_t start = bench_now_ns();
+  float sum = run_local(n, state);
+  for (int r = 0; r < REPS; ++r) {
+    stencil(out_g, in_g, n);
+    sum += out_g[r % n + 1];
+  }
+  uint64_t ns = bench_now_ns() - start;
+  return bench_report((uint64_t)(sum * 1000.0f), ns);
+}
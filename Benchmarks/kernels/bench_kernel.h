@@ -0,0 +1,34 @@
+/* Shared by the runtime kernels of run_benchmarks.py. Every kernel prints
+ * a single "<checksum> <nanoseconds>" line, the checksum is compared
+ * between the builds with and without a plugin. */
+#ifndef BENCH_KERNEL_H
+#define BENCH_KERNEL_H
+#define _POSIX_C_SOURCE 199309L
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Kept opaque to the optimizer, so that the inputs are not constant */
+#define BENCH_OPAQUE(x) __asm__ volatile("" : "+r"(x))
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64, to fill the inputs the same way in every build */
+static inline uint64_t bench_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static inline int bench_report(uint64_t checksum, uint64_t ns) {
+  printf("%llu %llu\n", (unsigned long long)checksum,
+         (unsigned long long)ns);
+  return 0;
+}
+#endif
@@ -0,0 +1,54 @@
+/* A hot loop with checks that call my_halt on failure, for HaltAnalyzer.
+ * The code after the halting calls is dead, and the branches into them
+ * are cold. */
+#include "bench_kernel.h"
+#include <stdlib.h>
+
+#define N 4096
+#define REPS 20000
+
+static int32_t data[N];
+
+__attribute__((noinline))
+void my_halt(const char *reason) {
+  fprintf(stderr, "halt: %s\n", reason);
+  abort();
+}
+
+__attribute__((noinline))
+static int64_t checked_sum(const int32_t *in, int n, int32_t limit) {
+  int64_t sum = 0;
+  for (int i = 0; i < n; ++i) {
+    int32_t x = in[i];
+    if (x > limit) {
+      my_halt("value out of range");
+      /* Recovery that never runs */
+      x = limit;
+      sum -= x / 3;
+    }
+    if (x < -limit) {
+      my_halt("value out of range");
+      x = -limit;
+      sum += x / 5;
+    }
+    sum += x % 7 == 0 ? x * 3 : x;
+  }
+  return sum;
+}
+
+int main(void) {
+  uint64_t state = 88172645463325252ULL;
+  for (int i = 0; i < N; ++i)
+    data[i] = (int32_t)(bench_random(&state) % 2000001) - 1000000;
+
+  uint64_t checksum = 0;
+  uint64_t start = bench_now_ns();
+  for (int r = 0; r < REPS; ++r) {
+    int n = N;
+    int32_t limit = 1000000;
+    BENCH_OPAQUE(n);
+    BENCH_OPAQUE(limit);
+    checksum += (uint64_t)checked_sum(data, n, limit);
+  }
+  return bench_report(checksum, bench_now_ns() - start);
+}
@@ -0,0 +1,37 @@
+/* Multiplications and divisions by constants in a hot loop, for
+ * SimpleMulOpt. */
+#include "bench_kernel.h"
+
+#define N 4096
+#define REPS 20000
+
+static uint64_t data[N];
+
+__attribute__((noinline))
+static uint64_t mix(const uint64_t *in, unsigned n) {
+  uint64_t acc = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    uint64_t x = in[i];
+    int64_t s = (int64_t)x;
+    acc += x * 9 + x * 15 + x * 36;
+    acc ^= x * 1000003 + x * 255;
+    acc += x * 0x9E3779B97F4A7C15ULL;
+    acc += (uint64_t)(s / 8) + (uint64_t)(s % 16);
+  }
+  return acc;
+}
+
+int main(void) {
+  uint64_t state = 88172645463325252ULL;
+  for (unsigned i = 0; i < N; ++i)
+    data[i] = bench_random(&state);
+
+  uint64_t checksum = 0;
+  uint64_t start = bench_now_ns();
+  for (unsigned r = 0; r < REPS; ++r) {
+    unsigned n = N;
+    BENCH_OPAQUE(n);
+    checksum += mix(data, n);
+  }
+  return bench_report(checksum, bench_now_ns() - start);
+}
@@ -0,0 +1,48 @@
+/* Unpredictable if/else on random data, for TernaryConverter. The
+ * kernel is timed as written and after being rewritten by the plugin with
+ * -apply-fixes. */
+#include "bench_kernel.h"
+
+#define N 4096
+#define REPS 20000
+
+static int32_t lhs[N], rhs[N];
+
+__attribute__((noinline))
+static int32_t clamp_low(int32_t x, int32_t low) {
+  if (x < low)
+    return low;
+  else
+    return x;
+}
+
+__attribute__((noinline))
+static int64_t select_sum(const int32_t *a, const int32_t *b, int n) {
+  int64_t sum = 0;
+  for (int i = 0; i < n; ++i) {
+    int32_t x;
+    if (a[i] > b[i])
+      x = a[i] - b[i];
+    else
+      x = b[i] + (a[i] >> 1);
+    sum += clamp_low(x, 100);
+  }
+  return sum;
+}
+
+int main(void) {
+  uint64_t state = 88172645463325252ULL;
+  for (int i = 0; i < N; ++i) {
+    lhs[i] = (int32_t)(bench_random(&state) % 100000);
+    rhs[i] = (int32_t)(bench_random(&state) % 100000);
+  }
+
+  uint64_t checksum = 0;
+  uint64_t start = bench_now_ns();
+  for (int r = 0; r < REPS; ++r) {
+    int n = N;
+    BENCH_OPAQUE(n);
+    checksum += (uint64_t)select_sum(lhs, rhs, n);
+  }
+  return bench_report(checksum, bench_now_ns() - start);
+}
@@ -0,0 +1,415 @@
+#!/usr/bin/env python3
+"""Compile-time and run-time benchmarks of the pass plugins.
+
+For every plugin given with --plugin, this script:
+ 1. Generates corpora of increasing sizes with bench-corpus-gen.
+ 2. Times the plugin's passes in isolation, then the whole default<O3>
+    pipeline with and without the plugin, with bench-passes. Each run is
+    a separate process, so its peak RSS is its own.
+ 3. Builds the runtime kernel of the plugin with and without it, runs both
+    and compares their execution time and checksum.
+
+The results are written as JSON. Passing the results of a previous run to
+--compare reports the entries that became slower, e.g. after an LLVM
+upgrade.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# How each plugin is exercised. `passes` are the names of its passes and
+# analyses, as reported by the pass instrumentation.
+PLUGINS = {
+    'SimpleMulOpt': {
+        'corpus': 'mul',
+        'pipeline': 'function(simple-mul-opt)',
+        'passes': ['SimpleMulOpt'],
+        'kernel': 'mul_kernel.c',
+    },
+    'HaltAnalyzer': {
+        'corpus': 'halt',
+        'pipeline': 'halt-propagation,function(halt-prune)',
+        'passes': ['HaltPropagation', 'HaltPruner', 'HaltAnalyzer',
+                   'HaltAnalysis'],
+        'kernel': 'halt_kernel.c',
+    },
+    'StrictOpt': {
+        'corpus': 'alias',
+        'pipeline': 'strict-opt-ipo,strict-opt-mv',
+        'passes': ['StrictOpt', 'StrictOptIPO', 'StrictOptMultiVersioning'],
+        'kernel': 'alias_kernel.c',
+    },
+    # A Clang plugin, timed on -fsyntax-only instead of a pass pipeline
+    'TernaryConverter': {
+        'corpus': 'ternary',
+        'kernel': 'ternary_kernel.c',
+    },
+}
+
+# Sizes of the corpora: multiplications for `mul`, functions otherwise
+DEFAULT_SIZES = {
+    'mul': [1000, 10000, 100000, 1000000],
+    'halt': [100, 1000, 10000],
+    'alias': [100, 1000, 10000],
+    'ternary': [100, 1000, 10000],
+}
+
+
+def log(msg):
+    print(msg, file=sys.stderr, flush=True)
+
+
+def run_measured(cmd):
+    """Run `cmd`, returning its completed process, wall time in ms and
+    peak RSS in KiB."""
+    with tempfile.TemporaryFile() as err:
+        start = time.perf_counter()
+        proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=err)
+        # Unlike wait(), wait4() gives the resource usage of this child only
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall = (time.perf_counter() - start) * 1000.0
+        err.seek(0)
+        stderr = err.read()
+    if os.WIFEXITED(status):
+        code = os.WEXITSTATUS(status)
+    else:
+        code = -os.WTERMSIG(status)
+    rss = usage.ru_maxrss
+    if sys.platform == 'darwin':
+        rss //= 1024
+    return subprocess.CompletedProcess(cmd, code, None, stderr), wall, rss
+
+
+def check(proc, what):
+    if proc.returncode != 0:
+        log(proc.stderr.decode(errors='replace'))
+        raise RuntimeError('%s failed with exit code %d' %
+                           (what, proc.returncode))
+
+
+def summarize(values):
+    return {
+        'min': min(values),
+        'median': statistics.median(values),
+        'max': max(values),
+    }
+
+
+def is_plugin_pass(name, passes):
+    # e.g. "(anonymous namespace)::SimpleMulOpt"
+    return name.rsplit('::', 1)[-1] in passes
+
+
+class Runner:
+    def __init__(self, args):
+        self.args = args
+        self.plugins = dict(p.split('=', 1) for p in args.plugin)
+        for name in self.plugins:
+            if name not in PLUGINS:
+                raise SystemExit('unknown plugin %s, expected one of %s' %
+                                 (name, ', '.join(PLUGINS)))
+        os.makedirs(args.work_dir, exist_ok=True)
+
+    def path(self, *parts):
+        return os.path.join(self.args.work_dir, *parts)
+
+    def sizes(self, corpus):
+        sizes = getattr(self.args, corpus + '_sizes')
+        return sizes if sizes else DEFAULT_SIZES[corpus]
+
+    def generate(self, corpus, size):
+        ext = '.c' if corpus == 'ternary' else '.bc'
+        out = self.path('%s-%d%s' % (corpus, size, ext))
+        if not os.path.exists(out):
+            log('generating %s' % out)
+            cmd = [self.args.corpus_gen, '-kind=' + corpus,
+                   '-size=%d' % size, '-depth=%d' % self.args.depth,
+                   '-o', out]
+            check(subprocess.run(cmd, capture_output=True), 'generating')
+        return out
+
+    def bench_passes(self, input, pipeline, plugin=None):
+        """Return the report of bench-passes, or None if the pipeline can't
+        be parsed."""
+        cmd = [self.args.bench_passes, '-passes=' + pipeline,
+               '-repeat=%d' % self.args.repeat, input]
+        if plugin:
+            cmd.insert(1, '-load-pass-plugin=' + plugin)
+        proc = subprocess.run(cmd, capture_output=True)
+        if proc.returncode == 2:
+            return None
+        check(proc, ' '.join(cmd))
+        return json.loads(proc.stdout)
+
+    def compile_time_passes(self, name, spec, plugin):
+        results = []
+        for size in self.sizes(spec['corpus']):
+            input = self.generate(spec['corpus'], size)
+            log('timing %s on %s' % (name, input))
+            entry = {'plugin': name, 'corpus': spec['corpus'], 'size': size}
+
+            isolated = self.bench_passes(input, spec['pipeline'], plugin)
+            if isolated:
+                entry['isolated'] = {
+                    'pipeline_ms': isolated['pipeline_ms'],
+                    'peak_rss_kib': isolated['peak_rss_kib'],
+                    'loaded_rss_kib': isolated['loaded_rss_kib'],
+                    'passes': [p for p in isolated['passes']
+                               if is_plugin_pass(p['name'], spec['passes'])],
+                }
+            else:
+                log('  %s is not available, skipped' % spec['pipeline'])
+
+            without = self.bench_passes(input, self.args.pipeline)
+            with_plugin = self.bench_passes(input, self.args.pipeline, plugin)
+            plugin_ms = sum(p['ms'] for p in with_plugin['passes']
+                            if is_plugin_pass(p['name'], spec['passes']))
+            entry['pipeline'] = {
+                'pipeline': self.args.pipeline,
+                'instructions': without['instructions'],
+                'without_plugin_ms': without['pipeline_ms'],
+                'with_plugin_ms': with_plugin['pipeline_ms'],
+                'plugin_passes_ms': plugin_ms,
+                'without_plugin_peak_rss_kib': without['peak_rss_kib'],
+                'with_plugin_peak_rss_kib': with_plugin['peak_rss_kib'],
+            }
+            results.append(entry)
+        return results
+
+    def clang_plugin_args(self, plugin, *plugin_args):
+        args = ['-Xclang', '-load', '-Xclang', plugin,
+                '-Xclang', '-add-plugin', '-Xclang', 'ternary-converter']
+        for arg in plugin_args:
+            args += ['-Xclang', '-plugin-arg-ternary-converter',
+                     '-Xclang', arg]
+        return args
+
+    def compile_time_clang(self, name, spec, plugin):
+        results = []
+        for size in self.sizes(spec['corpus']):
+            input = self.generate(spec['corpus'], size)
+            log('timing %s on %s' % (name, input))
+            entry = {'plugin': name, 'corpus': spec['corpus'], 'size': size}
+            base = [self.args.clang, '-fsyntax-only', '-w', input]
+            for key, cmd in (('without_plugin', base),
+                             ('with_plugin',
+                              base + self.clang_plugin_args(plugin))):
+                times, rss = [], 0
+                for _ in range(self.args.repeat):
+                    proc, wall, peak = run_measured(cmd)
+                    check(proc, ' '.join(cmd))
+                    times.append(wall)
+                    rss = max(rss, peak)
+                entry[key + '_ms'] = summarize(times)
+                entry[key + '_peak_rss_kib'] = rss
+            results.append(entry)
+        return results
+
+    def build_kernel(self, source, output, extra=()):
+        cmd = [self.args.clang, '-O3', '-fexperimental-new-pass-manager',
+               '-I', os.path.join(HERE, 'kernels'), source, '-o', output]
+        cmd += extra
+        proc = subprocess.run(cmd, capture_output=True)
+        check(proc, ' '.join(cmd))
+
+    def run_kernel(self, exe):
+        checksums, times = set(), []
+        for _ in range(self.args.runs):
+            proc = subprocess.run([exe], capture_output=True)
+            check(proc, exe)
+            checksum, ns = proc.stdout.split()
+            checksums.add(int(checksum))
+            times.append(int(ns) / 1e6)
+        return checksums, times
+
+    def runtime(self, name, spec, plugin):
+        source = os.path.join(HERE, 'kernels', spec['kernel'])
+        stem = os.path.splitext(spec['kernel'])[0]
+        base_exe = self.path(stem + '.base')
+        plugin_exe = self.path(stem + '.plugin')
+        log('building %s' % source)
+        self.build_kernel(source, base_exe)
+        if name == 'TernaryConverter':
+            # The plugin only rewrites the source
+            rewritten = self.path(spec['kernel'])
+            shutil.copy(source, rewritten)
+            cmd = [self.args.clang, '-fsyntax-only',
+                   '-I', os.path.join(HERE, 'kernels'), rewritten]
+            cmd += self.clang_plugin_args(plugin, '-apply-fixes')
+            check(subprocess.run(cmd, capture_output=True), ' '.join(cmd))
+            self.build_kernel(rewritten, plugin_exe)
+        else:
+            self.build_kernel(source, plugin_exe,
+                              ['-fpass-plugin=' + plugin])
+
+        log('running %s' % stem)
+        base_sums, base_times = self.run_kernel(base_exe)
+        plugin_sums, plugin_times = self.run_kernel(plugin_exe)
+        return {
+            'plugin': name,
+            'kernel': spec['kernel'],
+            'runs': self.args.runs,
+            'without_plugin_ms': summarize(base_times),
+            'with_plugin_ms': summarize(plugin_times),
+            'speedup': (statistics.median(base_times) /
+                        statistics.median(plugin_times)),
+            'checksum_match': (len(base_sums) == 1 and
+                               base_sums == plugin_sums),
+        }
+
+    def llvm_version(self):
+        proc = subprocess.run([self.args.bench_passes, '--version'],
+                              capture_output=True, text=True)
+        # e.g. "LLVM version 12.0.1", possibly after a vendor name
+        for line in proc.stdout.splitlines():
+            if 'LLVM version' in line:
+                return line.split()[-1]
+        return None
+
+    def run(self):
+        report = {
+            'schema': 1,
+            'date': datetime.datetime.now().isoformat(timespec='seconds'),
+            'host': platform.node(),
+            'machine': platform.machine(),
+            'llvm_version': self.llvm_version(),
+            'repeat': self.args.repeat,
+            'compile_time': [],
+            'runtime': [],
+        }
+        for name, plugin in sorted(self.plugins.items()):
+            spec = PLUGINS[name]
+            if not self.args.no_compile_time:
+                if 'pipeline' in spec:
+                    report['compile_time'] += \
+                        self.compile_time_passes(name, spec, plugin)
+                elif self.args.clang:
+                    report['compile_time'] += \
+                        self.compile_time_clang(name, spec, plugin)
+                else:
+                    log('no --clang, skipping the compile time of %s' % name)
+            if not self.args.no_runtime:
+                if self.args.clang:
+                    report['runtime'].append(self.runtime(name, spec, plugin))
+                else:
+                    log('no --clang, skipping the kernel of %s' % name)
+        return report
+
+
+def compile_time_key(entry):
+    return ('compile_time', entry['plugin'], entry['corpus'], entry['size'])
+
+
+def compare(old, new, threshold):
+    """Print the entries of `new` slower than in `old` by more than
+    `threshold`, return whether there are any."""
+    def medians(report):
+        values = {}
+        for entry in report['compile_time']:
+            key = compile_time_key(entry)
+            for mode in ('isolated', 'pipeline'):
+                for field, value in entry.get(mode, {}).items():
+                    if field.endswith('_ms') and isinstance(value, dict):
+                        values[key + (mode, field)] = value['median']
+            for field, value in entry.items():
+                if field.endswith('_ms') and isinstance(value, dict):
+                    values[key + (field,)] = value['median']
+        for entry in report['runtime']:
+            key = ('runtime', entry['plugin'], entry['kernel'])
+            values[key + ('with_plugin_ms',)] = \
+                entry['with_plugin_ms']['median']
+        return values
+
+    old_values, new_values = medians(old), medians(new)
+    regressed = False
+    print('comparing LLVM %s against %s' %
+          (new.get('llvm_version'), old.get('llvm_version')))
+    for key in sorted(set(old_values) & set(new_values),
+                      key=lambda k: tuple(map(str, k))):
+        before, after = old_values[key], new_values[key]
+        if before <= 0:
+            continue
+        ratio = after / before
+        if ratio > 1 + threshold:
+            regressed = True
+            print('  slower: %-70s %10.2f -> %10.2f ms (x%.2f)' %
+                  ('/'.join(map(str, key)), before, after, ratio))
+    if not regressed:
+        print('  no regression above %d%%' % (threshold * 100))
+    return regressed
+
+
+def parse_sizes(text):
+    return [int(float(s)) for s in text.split(',')]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--bench-passes', required=True,
+                        help='path to the bench-passes tool')
+    parser.add_argument('--corpus-gen', required=True,
+                        help='path to the bench-corpus-gen tool')
+    parser.add_argument('--plugin', action='append', default=[],
+                        metavar='NAME=PATH',
+                        help='plugin to benchmark, NAME is one of %s' %
+                             ', '.join(PLUGINS))
+    parser.add_argument('--clang',
+                        help='clang built against the same LLVM as the '
+                             'plugins, needed for the runtime kernels and '
+                             'TernaryConverter')
+    parser.add_argument('--pipeline', default='default<O3>',
+                        help='full pipeline compared with and without each '
+                             'plugin (default: %(default)s)')
+    for corpus in DEFAULT_SIZES:
+        parser.add_argument('--%s-sizes' % corpus, type=parse_sizes,
+                            help='comma separated sizes of the %s corpus '
+                                 '(default: %s)' %
+                                 (corpus, ','.join(map(str,
+                                                       DEFAULT_SIZES[corpus]))))
+    parser.add_argument('--depth', type=int, default=16,
+                        help='nesting depth of the halt and ternary corpora')
+    parser.add_argument('--repeat', type=int, default=5,
+                        help='repetitions of each compile-time measurement')
+    parser.add_argument('--runs', type=int, default=5,
+                        help='executions of each runtime kernel')
+    parser.add_argument('--no-compile-time', action='store_true')
+    parser.add_argument('--no-runtime', action='store_true')
+    parser.add_argument('--work-dir', default='bench-work',
+                        help='where the corpora and kernels are written')
+    parser.add_argument('-o', '--output', default='benchmarks.json')
+    parser.add_argument('--compare', metavar='OLD.json',
+                        help='report the regressions against a previous '
+                             'result')
+    parser.add_argument('--threshold', type=float, default=0.1,
+                        help='slowdown reported by --compare '
+                             '(default: %(default)s)')
+    args = parser.parse_args()
+
+    report = Runner(args).run()
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2)
+        f.write('\n')
+    log('results written to %s' % args.output)
+
+    if args.compare:
+        with open(args.compare) as f:
+            old = json.load(f)
+        if compare(old, report, args.threshold):
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,9 +1,431 @@
+//===----------------------------------------------------------------------===//
+/// Batch optimizer: run a pass pipeline, including passes from plugins,
+/// over many bitcode files in a single process.
+/// \code
+/// magic-cli -load-pass-plugin=libSimpleMulOpt.so
+///           -passes='function(simple-mul-opt)' -j 8 -o out/ inputs/
+/// \endcode
+//===----------------------------------------------------------------------===//
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
 using namespace llvm;
 
-static cl::opt<bool> Foo("foo", cl::init(false));
+static cl::list<std::string> Inputs(cl::Positional, cl::OneOrMore,
+                                    cl::desc("<.bc files or directories>"));
 
-int main(int argc, char** argv) {
-  cl::ParseCommandLineOptions(argc, argv);
-  return 0;
+// Loaded before the command line is parsed, see loadPassPlugins
+static cl::list<std::string>
+    PassPlugins("load-pass-plugin",
+                cl::desc("Load passes from plugin library"));
+
+static cl::opt<std::string>
+    PassPipeline("passes", cl::init("default<O2>"),
+                 cl::desc("Pipeline to run, in the syntax of opt -passes"));
+
+static cl::opt<std::string>
+    OutputDir("o", cl::value_desc("directory"),
+              cl::desc("Write the optimized modules into this directory"));
+
+static cl::opt<unsigned>
+    NumThreads("j", cl::init(0), cl::value_desc("N"),
+               cl::desc("Number of worker threads (default: all cores)"));
+
+static cl::opt<bool>
+    Lazy("lazy", cl::init(true),
+         cl::desc("Only deserialize the functions the pipeline runs on"));
+
+static cl::opt<bool> NoVerify("disable-verify", cl::init(false),
+                              cl::desc("Don't verify the optimized modules"));
+
+static cl::opt<bool> PrintSummary("summary", cl::init(false),
+                                  cl::desc("Print the number of modules and "
+                                           "the time spent at the end"));
+
+static std::mutex OutputLock;
+
+static void reportError(StringRef File, const Twine &Msg) {
+  std::lock_guard<std::mutex> Guard(OutputLock);
+  WithColor::error(errs(), "magic-cli") << File << ": " << Msg << "\n";
+}
+
+/// Plugins are loaded before parsing the rest of the command line, so
+/// that their own cl::opt are recognized.
+static bool loadPassPlugins(int argc, char **argv,
+                            std::vector<PassPlugin> &Plugins) {
+  for (int I = 1; I < argc; ++I) {
+    StringRef Arg(argv[I]);
+    if (!Arg.consume_front("-load-pass-plugin") &&
+        !Arg.consume_front("--load-pass-plugin"))
+      continue;
+    std::string Path;
+    if (Arg.consume_front("="))
+      Path = Arg.str();
+    else if (Arg.empty() && I + 1 < argc)
+      Path = argv[++I];
+    else
+      continue;
+
+    auto PluginOrErr = PassPlugin::Load(Path);
+    if (!PluginOrErr) {
+      WithColor::error(errs(), "magic-cli")
+          << "failed to load plugin " << Path << ": "
+          << toString(PluginOrErr.takeError()) << "\n";
+      return false;
+    }
+    Plugins.push_back(*PluginOrErr);
+  }
+  return true;
+}
+
+namespace {
+struct InputFile {
+  std::string Path;
+  /// Where it's written in the output directory: its path relative to
+  /// the directory it was found in, or its file name if given directly
+  std::string OutputName;
+};
+} // end anonymous namespace
+
+/// Expand directories into the .bc files they contain
+static std::vector<InputFile> collectInputs() {
+  std::vector<InputFile> Files;
+  for (const auto &Input : Inputs) {
+    if (!sys::fs::is_directory(Input)) {
+      Files.push_back({Input, sys::path::filename(Input).str()});
+      continue;
+    }
+    std::error_code EC;
+    for (sys::fs::recursive_directory_iterator It(Input, EC), End;
+         It != End && !EC; It.increment(EC)) {
+      if (sys::path::extension(It->path()) != ".bc")
+        continue;
+      StringRef RelPath(It->path());
+      RelPath.consume_front(Input);
+      while (!RelPath.empty() && sys::path::is_separator(RelPath.front()))
+        RelPath = RelPath.drop_front();
+      Files.push_back({It->path(), RelPath.str()});
+    }
+    if (EC)
+      reportError(Input, EC.message());
+  }
+  llvm::sort(Files, [](const InputFile &LHS, const InputFile &RHS) {
+    return LHS.Path < RHS.Path;
+  });
+  return Files;
+}
+
+/// Report the inputs that would overwrite each other's output
+static bool checkOutputNames(ArrayRef<InputFile> Files) {
+  StringMap<StringRef> Outputs;
+  bool Unique = true;
+  for (const auto &File : Files) {
+    auto Inserted = Outputs.try_emplace(File.OutputName, File.Path);
+    if (!Inserted.second) {
+      reportError(File.Path, "same output " + File.OutputName + " as " +
+                                 Inserted.first->second);
+      Unique = false;
+    }
+  }
+  return Unique;
+}
+
+/// Same as opt, modules without a known target, or whose target isn't
+/// built in, are optimized without target information.
+static std::unique_ptr<TargetMachine> createTargetMachine(StringRef TT) {
+  Triple ModuleTriple(TT);
+  if (ModuleTriple.getArch() == Triple::UnknownArch)
+    return nullptr;
+  std::string Err;
+  const Target *T = TargetRegistry::lookupTarget(ModuleTriple.str(), Err);
+  if (!T)
+    return nullptr;
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(
+      ModuleTriple.str(), /*CPU=*/"", /*Features=*/"", TargetOptions(),
+      /*RM=*/None));
+}
+
+namespace {
+/// Pass builder, analyses and pipeline for the modules of one target
+struct Pipeline {
+  std::unique_ptr<TargetMachine> TM;
+  PassBuilder PB;
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  ModulePassManager MPM;
+
+  Pipeline(std::unique_ptr<TargetMachine> TheTM,
+           PassInstrumentationCallbacks &PIC, ArrayRef<PassPlugin> Plugins);
+};
+
+/// State of one thread: its own context, and a pipeline for each target,
+/// all reused for every module it optimizes.
+class Worker {
+  LLVMContext Context;
+  PassInstrumentationCallbacks PIC;
+  ArrayRef<PassPlugin> Plugins;
+  StringMap<std::unique_ptr<Pipeline>> Pipelines;
+  /// Module being optimized, lazily loaded
+  Module *Current = nullptr;
+  bool AllMaterialized = false;
+  /// Why the current module couldn't be deserialized, if it couldn't
+  std::string MaterializeError;
+
+  Pipeline &getPipeline(const Module &M);
+
+  bool materializeAll();
+  bool materializeFor(StringRef PassID, Any IR);
+
+public:
+  explicit Worker(ArrayRef<PassPlugin> Plugins);
+
+  bool optimize(const InputFile &Input);
+};
+} // end anonymous namespace
+
+Pipeline::Pipeline(std::unique_ptr<TargetMachine> TheTM,
+                   PassInstrumentationCallbacks &PIC,
+                   ArrayRef<PassPlugin> Plugins)
+    : TM(std::move(TheTM)),
+      PB(/*DebugLogging=*/false, TM.get(), PipelineTuningOptions(),
+         /*PGOOpt=*/None, &PIC) {
+  for (const auto &Plugin : Plugins)
+    Plugin.registerPassBuilderCallbacks(PB);
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  // Already checked by main
+  cantFail(PB.parsePassPipeline(MPM, PassPipeline));
+}
+
+Worker::Worker(ArrayRef<PassPlugin> Plugins) : Plugins(Plugins) {
+  // Optional passes after a failed deserialization are skipped, the
+  // module is reported and dropped at the end
+  PIC.registerShouldRunOptionalPassCallback(
+      [this](StringRef PassID, Any IR) { return materializeFor(PassID, IR); });
+  PIC.registerBeforeNonSkippedPassCallback(
+      [this](StringRef PassID, Any IR) { materializeFor(PassID, IR); });
+}
+
+Pipeline &Worker::getPipeline(const Module &M) {
+  auto &P = Pipelines[M.getTargetTriple()];
+  if (!P)
+    P = std::make_unique<Pipeline>(createTargetMachine(M.getTargetTriple()),
+                                   PIC, Plugins);
+  return *P;
+}
+
+bool Worker::materializeAll() {
+  if (AllMaterialized)
+    return true;
+  if (Error E = Current->materializeAll()) {
+    MaterializeError = toString(std::move(E));
+    return false;
+  }
+  AllMaterialized = true;
+  return true;
+}
+
+/// Deserialize what the next pass is about to look at: only its function
+/// for function and loop passes, everything for other module passes.
+bool Worker::materializeFor(StringRef PassID, Any IR) {
+  if (!MaterializeError.empty())
+    return false;
+  if (AllMaterialized)
+    return true;
+
+  if (any_isa<const Function *>(IR)) {
+    auto *F = const_cast<Function *>(any_cast<const Function *>(IR));
+    if (Error E = F->materialize()) {
+      MaterializeError = toString(std::move(E));
+      return false;
+    }
+    return true;
+  }
+  // Loops only exist in functions that were already materialized
+  if (any_isa<const Loop *>(IR))
+    return true;
+  // These only visit the functions, through passes of their own
+  if (PassID == "ModuleToFunctionPassAdaptor" ||
+      PassID.startswith("PassManager<"))
+    return true;
+  return materializeAll();
+}
+
+bool Worker::optimize(const InputFile &Input) {
+  StringRef InputFile = Input.Path;
+  Expected<sys::fs::file_t> FDOrErr = sys::fs::openNativeFileForRead(InputFile);
+  if (!FDOrErr) {
+    reportError(InputFile, toString(FDOrErr.takeError()));
+    return false;
+  }
+  sys::fs::file_status Status;
+  if (std::error_code EC = sys::fs::status(*FDOrErr, Status)) {
+    sys::fs::closeFile(*FDOrErr);
+    reportError(InputFile, EC.message());
+    return false;
+  }
+  // Big enough files are mmap-ed instead of read, without a null
+  // terminator the mapping doesn't need to be copied
+  auto BufferOrErr =
+      MemoryBuffer::getOpenFile(*FDOrErr, InputFile, Status.getSize(),
+                                /*RequiresNullTerminator=*/false);
+  sys::fs::closeFile(*FDOrErr);
+  if (!BufferOrErr) {
+    reportError(InputFile, BufferOrErr.getError().message());
+    return false;
+  }
+
+  auto ModuleOrErr = getOwningLazyBitcodeModule(
+      std::move(*BufferOrErr), Context, /*ShouldLazyLoadMetadata=*/true);
+  if (!ModuleOrErr) {
+    reportError(InputFile, toString(ModuleOrErr.takeError()));
+    return false;
+  }
+  std::unique_ptr<Module> M = std::move(*ModuleOrErr);
+  Current = M.get();
+  AllMaterialized = false;
+  MaterializeError.clear();
+  // Not left dangling once the module is destroyed
+  auto Done = make_scope_exit([this] { Current = nullptr; });
+
+  if (Lazy || materializeAll()) {
+    Pipeline &P = getPipeline(*M);
+    P.MPM.run(*M, P.MAM);
+    // Analyses of this module are stale once it's destroyed. The inner
+    // managers are cleared too, the CGSCC results are keyed by the SCCs
+    // of a call graph that's about to go away.
+    P.LAM.clear();
+    P.FAM.clear();
+    P.CGAM.clear();
+    P.MAM.clear();
+  }
+
+  if (!NoVerify || !OutputDir.empty())
+    materializeAll();
+  if (!MaterializeError.empty()) {
+    reportError(InputFile, "failed to materialize: " + MaterializeError);
+    return false;
+  }
+  if (!NoVerify) {
+    std::string Msg;
+    raw_string_ostream OS(Msg);
+    if (verifyModule(*M, &OS)) {
+      reportError(InputFile, "broken module after optimization:\n" + OS.str());
+      return false;
+    }
+  }
+
+  if (!OutputDir.empty()) {
+    SmallString<128> OutputFile(OutputDir);
+    sys::path::append(OutputFile, Input.OutputName);
+    std::error_code EC =
+        sys::fs::create_directories(sys::path::parent_path(OutputFile));
+    if (EC) {
+      reportError(OutputFile, EC.message());
+      return false;
+    }
+    raw_fd_ostream OS(OutputFile, EC, sys::fs::OF_None);
+    if (EC) {
+      reportError(OutputFile, EC.message());
+      return false;
+    }
+    WriteBitcodeToFile(*M, OS);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeAllTargetInfos();
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+
+  std::vector<PassPlugin> Plugins;
+  if (!loadPassPlugins(argc, argv, Plugins))
+    return 1;
+  cl::ParseCommandLineOptions(argc, argv, "Batch bitcode optimizer\n");
+
+  // Report a bad pipeline once, instead of in every worker
+  {
+    PassBuilder PB;
+    for (const auto &Plugin : Plugins)
+      Plugin.registerPassBuilderCallbacks(PB);
+    ModulePassManager MPM;
+    if (Error E = PB.parsePassPipeline(MPM, PassPipeline)) {
+      WithColor::error(errs(), "magic-cli") << toString(std::move(E)) << "\n";
+      return 1;
+    }
+  }
+
+  if (!OutputDir.empty())
+    if (std::error_code EC = sys::fs::create_directories(OutputDir)) {
+      reportError(OutputDir, EC.message());
+      return 1;
+    }
+
+  auto Start = std::chrono::steady_clock::now();
+  std::vector<InputFile> Files = collectInputs();
+  if (!OutputDir.empty() && !checkOutputNames(Files))
+    return 1;
+  std::atomic<size_t> NextFile(0);
+  std::atomic<unsigned> NumFailed(0);
+
+  auto Strategy = hardware_concurrency(NumThreads);
+  unsigned NumWorkers = std::min<size_t>(Strategy.compute_thread_count(),
+                                         std::max<size_t>(Files.size(), 1));
+  ThreadPool Pool(Strategy);
+  // Every task is a worker pulling files until there are none left
+  for (unsigned I = 0; I < NumWorkers; ++I)
+    Pool.async([&] {
+      Worker W(Plugins);
+      for (size_t Idx = NextFile++; Idx < Files.size(); Idx = NextFile++)
+        if (!W.optimize(Files[Idx]))
+          ++NumFailed;
+    });
+  Pool.wait();
+
+  if (PrintSummary) {
+    auto Elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - Start);
+    errs() << "magic-cli: " << Files.size() << " modules, " << NumFailed
+           << " failed, in " << Elapsed.count() << " ms with " << NumWorkers
+           << " threads\n";
+  }
+  return NumFailed ? 1 : 0;
 }
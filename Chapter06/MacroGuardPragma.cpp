@@ -3,25 +3,24 @@
 #include "clang/Lex/Token.h"
 #include "clang/Lex/Pragma.h"
 #include "clang/Lex/Preprocessor.h"
-#include "llvm/Support/raw_ostream.h"
 
 #include "MacroGuardValidator.h"
 
 using namespace clang;
-
-namespace macro_guard {
-llvm::SmallVector<const IdentifierInfo*, 2> ArgsToEnclosed;
-} // end namespace macro_guard
-
 using namespace macro_guard;
 
 namespace {
+/// `#pragma macro_arg_guard a b` guards arguments `a` and `b` of the
+/// next macro definition, and its redefinitions later on.
+/// `#pragma macro_arg_guard *` guards every argument of all the macros
+/// defined after it, until an empty `#pragma macro_arg_guard`.
 class MacroGuardPragma : public PragmaHandler {
-  bool IsValidatorRegistered;
+  /// Owned by the preprocessor once registered
+  MacroGuardValidator *Validator;
 
 public:
   MacroGuardPragma() : PragmaHandler("macro_arg_guard"),
-                       IsValidatorRegistered(false) {}
+                       Validator(nullptr) {}
 
   void HandlePragma(Preprocessor &PP, PragmaIntroducer Introducer,
                     Token &PragmaTok) override;
@@ -30,24 +29,30 @@ public:
 
 void MacroGuardPragma::HandlePragma(Preprocessor &PP, PragmaIntroducer Introducer,
                                     Token &PragmaTok) {
+  if (!Validator) {
+    // Register the validator PPCallbacks
+    auto NewValidator =
+      std::make_unique<MacroGuardValidator>(PP.getDiagnostics());
+    Validator = NewValidator.get();
+    PP.addPPCallbacks(std::move(NewValidator));
+  }
+
   // Reset the to-be-enclosed argument list
-  ArgsToEnclosed.clear();
+  Validator->clearPendingArgs();
 
   Token Tok;
   PP.Lex(Tok);
+  if (Tok.is(tok::eod)) {
+    Validator->setGuardAll(false);
+    return;
+  }
   while (Tok.isNot(tok::eod)) {
-    if (auto *II = Tok.getIdentifierInfo()) {
-      ArgsToEnclosed.push_back(II);
-    }
+    if (Tok.is(tok::star))
+      Validator->setGuardAll(true);
+    else if (auto *II = Tok.getIdentifierInfo())
+      Validator->addPendingArg(II);
     PP.Lex(Tok);
   }
-
-  if (!IsValidatorRegistered) {
-    // Register the validator PPCallbacks
-    auto Validator = std::make_unique<MacroGuardValidator>(PP.getSourceManager());
-    PP.addPPCallbacks(std::move(Validator));
-    IsValidatorRegistered = true;
-  }
 }
 
 static PragmaHandlerRegistry::Add<MacroGuardPragma> X("macro_arg_guard", "");
@@ -1,54 +1,92 @@
+#include "clang/Basic/Diagnostic.h"
 #include "clang/Basic/IdentifierTable.h"
-#include "clang/Basic/SourceManager.h"
 #include "clang/Lex/MacroInfo.h"
 #include "clang/Lex/Token.h"
-#include "llvm/ADT/STLExtras.h"
-#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/SmallVector.h"
 
 #include "MacroGuardValidator.h"
 
 using namespace clang;
 using namespace macro_guard;
 
+MacroGuardValidator::MacroGuardValidator(DiagnosticsEngine &Diags)
+  : Diags(Diags) {
+  DiagNotEnclosed = Diags.getCustomDiagID(
+    DiagnosticsEngine::Warning,
+    "macro argument '%0' is not enclosed by parenthesis");
+  DiagArgNotFound = Diags.getCustomDiagID(
+    DiagnosticsEngine::Warning,
+    "can't find argument '%0' at macro '%1'");
+}
+
 void MacroGuardValidator::MacroDefined(const Token &MacroNameTok,
                                        const MacroDirective *MD) {
   const auto *MI = MD->getMacroInfo();
-  if (MI->tokens_empty()) return;
-
-  for (const auto *ArgII : ArgsToEnclosed) {
-    // First, check if this macro really has this argument
-    if (llvm::none_of(MI->params(), [ArgII](const IdentifierInfo *II) {
-                                      return ArgII == II;
-                                    })) {
-      auto *MacroNameII = MacroNameTok.getIdentifierInfo();
-      assert(MacroNameII);
-      auto NameTokLoc = MacroNameTok.getLocation();
-      llvm::errs() << "[WARNING] Can't find argument '" << ArgII->getName() << "' ";
-      llvm::errs() << "at macro '" << MacroNameII->getName() << "'(";
-      llvm::errs() << NameTokLoc.printToString(SM) << ")\n";
-      continue;
-    }
+  auto *MacroNameII = MacroNameTok.getIdentifierInfo();
+  assert(MacroNameII);
 
-    for (auto TokIdx = 0U, TokSize = MI->getNumTokens();
-         TokIdx < TokSize; ++TokIdx) {
-      auto CurTok = *(MI->tokens_begin() + TokIdx);
-      if (CurTok.getIdentifierInfo() == ArgII) {
-        // Check if previous and successor Tokens are parenthesis
-        if (TokIdx > 0 && TokIdx < TokSize - 1) {
-          auto PrevTok = *(MI->tokens_begin() + TokIdx - 1),
-               NextTok = *(MI->tokens_begin() + TokIdx + 1);
-          if (PrevTok.is(tok::l_paren) && NextTok.is(tok::r_paren))
-            continue;
-        }
-        // The argument is not enclosed
-        auto TokLoc = CurTok.getLocation();
-        llvm::errs() << "[WARNING] In " << TokLoc.printToString(SM) << ": ";
-        llvm::errs() << "macro argument '" << ArgII->getName()
-                     << "' is not enclosed by parenthesis\n";
+  auto It = Guards.find(MacroNameII);
+  if (PendingArgs.empty() && !GuardAll && It == Guards.end()) return;
+
+  // Map the parameters to their indices, so that looking up each token
+  // doesn't depend on the number of parameters
+  ParamIndexMap ParamIndices;
+  for (auto Idx = 0U, Size = MI->getNumParams(); Idx < Size; ++Idx)
+    ParamIndices[MI->params()[Idx]] = Idx;
+
+  if (!PendingArgs.empty() || GuardAll) {
+    llvm::SmallBitVector GuardedParams(MI->getNumParams(), GuardAll);
+    for (const auto *ArgII : PendingArgs) {
+      auto ParamIt = ParamIndices.find(ArgII);
+      if (ParamIt == ParamIndices.end()) {
+        Diags.Report(MacroNameTok.getLocation(), DiagArgNotFound)
+          << ArgII->getName() << MacroNameII->getName();
+        continue;
       }
+      GuardedParams.set(ParamIt->second);
     }
+    PendingArgs.clear();
+
+    if (GuardedParams.none()) return;
+    Guards[MacroNameII] = std::move(GuardedParams);
+    It = Guards.find(MacroNameII);
+  } else if (It->second.size() != MI->getNumParams()) {
+    // A redefinition with a different signature, the guarded indices
+    // are meaningless now
+    Guards.erase(It);
+    return;
   }
 
-  // Also clear the storage after one check
-  ArgsToEnclosed.clear();
+  validate(*MI, ParamIndices, It->second);
+}
+
+/// Check that every guarded parameter in the body of \p MI is enclosed
+/// by parenthesis, in a single pass over the tokens.
+void MacroGuardValidator::validate(const MacroInfo &MI,
+                                   const ParamIndexMap &ParamIndices,
+                                   const llvm::SmallBitVector &GuardedParams) {
+  auto Tokens = MI.tokens();
+  for (auto TokIdx = 0U, TokSize = MI.getNumTokens();
+       TokIdx < TokSize; ++TokIdx) {
+    const auto &CurTok = Tokens[TokIdx];
+    const auto *II = CurTok.getIdentifierInfo();
+    if (!II) continue;
+    auto ParamIt = ParamIndices.find(II);
+    if (ParamIt == ParamIndices.end() || !GuardedParams.test(ParamIt->second))
+      continue;
+
+    const Token *PrevTok = TokIdx > 0? &Tokens[TokIdx - 1] : nullptr,
+                *NextTok = TokIdx < TokSize - 1? &Tokens[TokIdx + 1] : nullptr;
+    // Check if previous and successor Tokens are parenthesis
+    if (PrevTok && NextTok &&
+        PrevTok->is(tok::l_paren) && NextTok->is(tok::r_paren))
+      continue;
+    // Stringified or pasted arguments can't be enclosed
+    if ((PrevTok && PrevTok->isOneOf(tok::hash, tok::hashhash)) ||
+        (NextTok && NextTok->is(tok::hashhash)))
+      continue;
+
+    // The argument is not enclosed
+    Diags.Report(CurTok.getLocation(), DiagNotEnclosed) << II->getName();
+  }
 }
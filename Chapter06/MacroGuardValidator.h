@@ -1,24 +1,48 @@
 #ifndef MACRO_GUARD_VALIDATOR_H
 #define MACRO_GUARD_VALIDATOR_H
 #include "clang/Lex/PPCallbacks.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallBitVector.h"
 #include "llvm/ADT/SmallVector.h"
 
 namespace clang {
 // Forward declarations
 class Token;
 class MacroDirective;
+class MacroInfo;
 class IdentifierInfo;
-class SourceManager;
+class DiagnosticsEngine;
 } // end namespace clang
 
 namespace macro_guard {
-extern llvm::SmallVector<const clang::IdentifierInfo*, 2> ArgsToEnclosed;
-
 class MacroGuardValidator : public clang::PPCallbacks {
-  clang::SourceManager &SM;
+  clang::DiagnosticsEngine &Diags;
+  unsigned DiagNotEnclosed, DiagArgNotFound;
+
+  /// Arguments named by the last `#pragma macro_arg_guard`, to be
+  /// guarded in the next macro definition
+  llvm::SmallVector<const clang::IdentifierInfo*, 2> PendingArgs;
+  /// Guard every argument of the macros defined between
+  /// `#pragma macro_arg_guard *` and an empty `#pragma macro_arg_guard`
+  bool GuardAll = false;
+
+  /// Indices of the guarded parameters of each macro. They persist
+  /// across redefinitions of the same macro.
+  llvm::DenseMap<const clang::IdentifierInfo*, llvm::SmallBitVector> Guards;
+
+  using ParamIndexMap = llvm::SmallDenseMap<const clang::IdentifierInfo*,
+                                            unsigned, 8>;
+  void validate(const clang::MacroInfo &MI, const ParamIndexMap &ParamIndices,
+                const llvm::SmallBitVector &GuardedParams);
 
 public:
-  explicit MacroGuardValidator(clang::SourceManager &SM) : SM(SM) {}
+  explicit MacroGuardValidator(clang::DiagnosticsEngine &Diags);
+
+  void addPendingArg(const clang::IdentifierInfo *II) {
+    PendingArgs.push_back(II);
+  }
+  void clearPendingArgs() { PendingArgs.clear(); }
+  void setGuardAll(bool Enable) { GuardAll = Enable; }
 
   void MacroDefined(const clang::Token &MacroNameToke,
                     const clang::MacroDirective *MD) override;
@@ -0,0 +1,289 @@
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Basic/IdentifierTable.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Lex/Token.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+
+#include "MacroProfiler.h"
+
+using namespace clang;
+using namespace macro_guard;
+
+MacroCost &MacroCost::operator+=(const MacroCost &RHS) {
+  Expansions += RHS.Expansions;
+  Tokens += RHS.Tokens;
+  MaxDepth = std::max(MaxDepth, RHS.MaxDepth);
+  Nanos += RHS.Nanos;
+  return *this;
+}
+
+MacroProfiler::MacroProfiler(Preprocessor &PP)
+  : PP(PP), SM(PP.getSourceManager()) {}
+
+unsigned MacroProfiler::getCostIndex(const IdentifierInfo *II) {
+  auto Inserted = CostIndices.try_emplace(II, Costs.size());
+  if (Inserted.second) {
+    Costs.emplace_back();
+    Names.push_back(II);
+  }
+  return Inserted.first->second;
+}
+
+MacroProfiler::CacheEntry &
+MacroProfiler::getCacheEntry(SourceLocation NameLoc) {
+  auto Hash = NameLoc.getRawEncoding();
+  Hash ^= Hash >> 10;
+  return ExpansionCache[Hash % ExpansionCache.size()];
+}
+
+void MacroProfiler::MacroExpands(const Token &MacroNameTok,
+                                 const MacroDefinition &MD,
+                                 SourceRange Range, const MacroArgs *Args) {
+  // A nested macro starting the expansion of another one ends the time
+  // charged to the outer macro
+  auto Now = finishPending();
+
+  auto CostIdx = getCostIndex(MacroNameTok.getIdentifierInfo());
+  auto &Cost = Costs[CostIdx];
+  ++Cost.Expansions;
+
+  // The name of a nested macro comes from the expansion of another one
+  unsigned Depth = 0;
+  for (auto Loc = MacroNameTok.getLocation(); Loc.isMacroID();
+       Loc = SM.getImmediateExpansionRange(Loc).getBegin())
+    ++Depth;
+  Cost.MaxDepth = std::max(Cost.MaxDepth, Depth);
+
+  auto &Entry = getCacheEntry(MacroNameTok.getLocation());
+  Entry.NameLoc = MacroNameTok.getLocation();
+  Entry.CostIdx = CostIdx;
+
+  PendingIdx = CostIdx;
+  PendingStart = Now;
+}
+
+void MacroProfiler::If(SourceLocation Loc, SourceRange ConditionRange,
+                       ConditionValueKind ConditionValue) {
+  finishPending();
+}
+
+void MacroProfiler::Elif(SourceLocation Loc, SourceRange ConditionRange,
+                         ConditionValueKind ConditionValue,
+                         SourceLocation IfLoc) {
+  finishPending();
+}
+
+void MacroProfiler::EndOfMainFile() { finishPending(); }
+
+MacroProfiler::Clock::time_point MacroProfiler::finishPending() {
+  auto Now = Clock::now();
+  if (PendingIdx != NoMacro) {
+    auto Elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     Now - PendingStart);
+    Costs[PendingIdx].Nanos += Elapsed.count();
+    PendingIdx = NoMacro;
+  }
+  return Now;
+}
+
+void MacroProfiler::addToken(const Token &Tok) {
+  // The parser also reports the annotation tokens it creates
+  if (Tok.isAnnotation()) return;
+
+  // Nothing else is read from the clock while no expansion is pending
+  if (PendingIdx != NoMacro)
+    finishPending();
+
+  auto Loc = Tok.getLocation();
+  if (!Loc.isMacroID()) return;
+
+  // Tokens from an argument are charged to the macro using it
+  while (SM.isMacroArgExpansion(Loc))
+    Loc = SM.getImmediateExpansionRange(Loc).getBegin();
+  auto NameLoc = SM.getImmediateExpansionRange(Loc).getBegin();
+
+  auto &Entry = getCacheEntry(NameLoc);
+  if (Entry.NameLoc != NameLoc) {
+    // Evicted from the cache, look it up by name instead
+    auto Name = Lexer::getImmediateMacroName(Loc, SM, PP.getLangOpts());
+    Entry.NameLoc = NameLoc;
+    Entry.CostIdx = getCostIndex(PP.getIdentifierInfo(Name));
+  }
+  ++Costs[Entry.CostIdx].Tokens;
+}
+
+void MacroProfiler::mergeInto(llvm::StringMap<MacroCost> &Merged) const {
+  for (unsigned Idx = 0, Size = Costs.size(); Idx < Size; ++Idx)
+    Merged[Names[Idx]->getName()] += Costs[Idx];
+}
+
+void macro_guard::printMacroCosts(llvm::raw_ostream &OS,
+                                  const llvm::StringMap<MacroCost> &Costs,
+                                  unsigned Top) {
+  llvm::SmallVector<const llvm::StringMapEntry<MacroCost>*, 32> Ranked;
+  for (const auto &Entry : Costs)
+    Ranked.push_back(&Entry);
+  llvm::sort(Ranked, [](const auto *LHS, const auto *RHS) {
+    if (LHS->second.Nanos != RHS->second.Nanos)
+      return LHS->second.Nanos > RHS->second.Nanos;
+    return LHS->first() < RHS->first();
+  });
+  if (Top && Ranked.size() > Top)
+    Ranked.resize(Top);
+
+  OS << "# macro expansions tokens max-depth expansion-time(ns)\n";
+  for (const auto *Entry : Ranked) {
+    const auto &Cost = Entry->second;
+    OS << Entry->first() << " " << Cost.Expansions << " " << Cost.Tokens
+       << " " << Cost.MaxDepth << " " << Cost.Nanos << "\n";
+  }
+}
+
+void macro_guard::parseMacroCosts(llvm::StringRef Buffer,
+                                  llvm::StringMap<MacroCost> &Costs) {
+  llvm::SmallVector<llvm::StringRef, 8> Lines, Fields;
+  Buffer.split(Lines, '\n', -1, /*KeepEmpty=*/false);
+  for (auto Line : Lines) {
+    if (Line.startswith("#")) continue;
+    Fields.clear();
+    Line.split(Fields, ' ', -1, /*KeepEmpty=*/false);
+    MacroCost Cost;
+    if (Fields.size() != 5 ||
+        Fields[1].getAsInteger(10, Cost.Expansions) ||
+        Fields[2].getAsInteger(10, Cost.Tokens) ||
+        Fields[3].getAsInteger(10, Cost.MaxDepth) ||
+        Fields[4].getAsInteger(10, Cost.Nanos))
+      continue;
+    Costs[Fields[0]] += Cost;
+  }
+}
+
+/// Add \p Costs to the report at \p MergePath, which is shared by all
+/// the TUs of a build, and possibly by concurrent compilations.
+static void mergeReport(StringRef MergePath,
+                        const llvm::StringMap<MacroCost> &Costs) {
+  // Give up rather than hang the build if the owner of the lock is stuck
+  constexpr unsigned MaxTimeouts = 3;
+  unsigned Timeouts = 0;
+  while (true) {
+    llvm::LockFileManager Lock(MergePath);
+    switch (Lock) {
+    case llvm::LockFileManager::LFS_Error:
+      llvm::errs() << "Failed to lock " << MergePath << "\n";
+      return;
+    case llvm::LockFileManager::LFS_Shared:
+      // Someone else is merging, try again once they're done
+      if (Lock.waitForUnlock() == llvm::LockFileManager::Res_Timeout &&
+          ++Timeouts == MaxTimeouts) {
+        llvm::errs() << "Timed out waiting for the lock on " << MergePath
+                     << ", costs of this TU not merged\n";
+        return;
+      }
+      continue;
+    case llvm::LockFileManager::LFS_Owned:
+      break;
+    }
+
+    llvm::StringMap<MacroCost> Merged;
+    if (auto Buffer = llvm::MemoryBuffer::getFile(MergePath))
+      parseMacroCosts((*Buffer)->getBuffer(), Merged);
+    for (const auto &Entry : Costs)
+      Merged[Entry.first()] += Entry.second;
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(MergePath, EC, llvm::sys::fs::OF_Text);
+    if (EC) {
+      llvm::errs() << "Failed to write " << MergePath << ": "
+                   << EC.message() << "\n";
+      return;
+    }
+    printMacroCosts(OS, Merged, /*Top=*/0);
+    return;
+  }
+}
+
+namespace {
+/// Report the costs once the whole TU has been preprocessed. The plugin
+/// action itself is gone by then, so the options are copied here.
+class MacroProfileConsumer : public ASTConsumer {
+  MacroProfiler &Profiler;
+  std::string InFile;
+  unsigned Top;
+  std::string MergePath;
+
+public:
+  MacroProfileConsumer(MacroProfiler &Profiler, StringRef InFile,
+                       unsigned Top, StringRef MergePath)
+    : Profiler(Profiler), InFile(InFile.str()), Top(Top),
+      MergePath(MergePath.str()) {}
+
+  void HandleTranslationUnit(ASTContext &Ctx) override {
+    llvm::StringMap<MacroCost> Costs;
+    Profiler.mergeInto(Costs);
+    llvm::errs() << "Macro expansion costs of " << InFile << ":\n";
+    printMacroCosts(llvm::errs(), Costs, Top);
+
+    if (!MergePath.empty())
+      mergeReport(MergePath, Costs);
+  }
+};
+
+/// Profile the macro expansions alongside the normal compilation,
+/// watching the tokens as they come out of the preprocessor.
+class MacroProfileAction : public PluginASTAction {
+  /// Number of macros in the per-TU report
+  unsigned Top = 20;
+  /// File accumulating the costs of all the TUs
+  std::string MergePath;
+
+public:
+  bool ParseArgs(const CompilerInstance &CI,
+                 const std::vector<std::string> &Args) override;
+
+  ActionType getActionType() override { return AddAfterMainAction; }
+
+  std::unique_ptr<ASTConsumer>
+  CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override {
+    auto &PP = CI.getPreprocessor();
+    auto NewProfiler = std::make_unique<MacroProfiler>(PP);
+    auto *Profiler = NewProfiler.get();
+    PP.addPPCallbacks(std::move(NewProfiler));
+    PP.setTokenWatcher(
+      [Profiler](const Token &Tok) { Profiler->addToken(Tok); });
+    return std::make_unique<MacroProfileConsumer>(*Profiler, InFile, Top,
+                                                  MergePath);
+  }
+};
+} // end anonymous namespace
+
+bool MacroProfileAction::ParseArgs(const CompilerInstance &CI,
+                                   const std::vector<std::string> &Args) {
+  for (const auto &Arg : Args) {
+    StringRef ArgRef(Arg);
+    if (ArgRef.consume_front("-merge="))
+      MergePath = ArgRef.str();
+    else if (ArgRef.consume_front("-top=") && ArgRef.getAsInteger(10, Top)) {
+      auto &Diag = CI.getDiagnostics();
+      Diag.Report(Diag.getCustomDiagID(DiagnosticsEngine::Error,
+                                       "invalid plugin argument '%0'"))
+        << Arg;
+      return false;
+    }
+  }
+  return true;
+}
+
+static FrontendPluginRegistry::Add<MacroProfileAction>
+  Y("macro-profile", "Report the cost of expanding each macro");
@@ -0,0 +1,111 @@
+#ifndef MACRO_PROFILER_H
+#define MACRO_PROFILER_H
+#include "clang/Lex/PPCallbacks.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace clang {
+// Forward declarations
+class Token;
+class IdentifierInfo;
+class Preprocessor;
+class SourceManager;
+} // end namespace clang
+
+namespace llvm {
+class raw_ostream;
+} // end namespace llvm
+
+namespace macro_guard {
+struct MacroCost {
+  uint64_t Expansions = 0;
+  /// Tokens produced by the expansions, excluding the ones from nested
+  /// macros
+  uint64_t Tokens = 0;
+  /// Deepest nesting level this macro was expanded at
+  unsigned MaxDepth = 0;
+  /// Time the preprocessor spent expanding it: from the start of an
+  /// expansion until its first token comes out, which covers substituting
+  /// and pre-expanding the arguments. Reading the arguments and parsing
+  /// the tokens is not included, and nested expansions are charged to
+  /// their own macro.
+  uint64_t Nanos = 0;
+
+  MacroCost &operator+=(const MacroCost &RHS);
+};
+
+/// Record the cost of each macro. Only a counter per macro is kept, so
+/// nothing is allocated per expansion, and the clock is only read at the
+/// start of an expansion and when its first token comes out.
+class MacroProfiler : public clang::PPCallbacks {
+  using Clock = std::chrono::steady_clock;
+
+  clang::Preprocessor &PP;
+  clang::SourceManager &SM;
+
+  std::vector<MacroCost> Costs;
+  std::vector<const clang::IdentifierInfo*> Names;
+  llvm::DenseMap<const clang::IdentifierInfo*, unsigned> CostIndices;
+
+  /// Direct-mapped cache from the location of an expanded macro name
+  /// to the index of its cost, saving the name lookup for each token.
+  struct CacheEntry {
+    clang::SourceLocation NameLoc;
+    unsigned CostIdx = 0;
+  };
+  std::array<CacheEntry, 1024> ExpansionCache;
+
+  static constexpr unsigned NoMacro = ~0U;
+  /// The macro being expanded whose first token hasn't come out yet, and
+  /// when its expansion started
+  unsigned PendingIdx = NoMacro;
+  Clock::time_point PendingStart;
+
+  /// Charge the time since PendingStart to PendingIdx, returning the
+  /// current time
+  Clock::time_point finishPending();
+
+  unsigned getCostIndex(const clang::IdentifierInfo *II);
+  CacheEntry &getCacheEntry(clang::SourceLocation NameLoc);
+
+public:
+  explicit MacroProfiler(clang::Preprocessor &PP);
+
+  void MacroExpands(const clang::Token &MacroNameTok,
+                    const clang::MacroDefinition &MD,
+                    clang::SourceRange Range,
+                    const clang::MacroArgs *Args) override;
+
+  /// Macros expanded in a condition don't produce any token for the
+  /// parser, their expansion ends with the directive.
+  void If(clang::SourceLocation Loc, clang::SourceRange ConditionRange,
+          ConditionValueKind ConditionValue) override;
+  void Elif(clang::SourceLocation Loc, clang::SourceRange ConditionRange,
+            ConditionValueKind ConditionValue,
+            clang::SourceLocation IfLoc) override;
+
+  void EndOfMainFile() override;
+
+  /// Charge \p Tok to the macro it was expanded from, and end the timing
+  /// of the pending expansion. Meant to be the token watcher of the
+  /// preprocessor.
+  void addToken(const clang::Token &Tok);
+
+  /// Add the costs of this TU to \p Merged.
+  void mergeInto(llvm::StringMap<MacroCost> &Merged) const;
+};
+
+/// Print the \p Top most expensive macros in \p Costs.
+void printMacroCosts(llvm::raw_ostream &OS,
+                     const llvm::StringMap<MacroCost> &Costs,
+                     unsigned Top);
+
+/// Read back the costs printed by printMacroCosts.
+void parseMacroCosts(llvm::StringRef Buffer,
+                     llvm::StringMap<MacroCost> &Costs);
+} // end namespace macro_guard
+#endif
@@ -1,47 +1,150 @@
 #include "TernaryConverter.h"
+#include "TernaryMatchers.h"
+#include "TernaryProfile.h"
+#include "clang/AST/ASTConsumer.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Rewrite/Core/Rewriter.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/FormatVariadic.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <tuple>
+#include <utility>
 
 using namespace clang;
 using namespace ast_matchers;
 
+namespace clang {
+/// Apply the ternary rewrites to the source buffers, dropping any edit
+/// that overlaps with the ones that are already applied.
+class TernaryFixItApplier {
+  Rewriter Rewrite;
+  /// Replaced [begin, end) offsets in each file
+  llvm::DenseMap<FileID, std::map<unsigned, unsigned>> Edits;
+
+public:
+  TernaryFixItApplier(SourceManager &SM, const LangOptions &LangOpts) {
+    Rewrite.setSourceMgr(SM, LangOpts);
+  }
+
+  /// Return false if \p Range can't be rewritten.
+  bool replace(CharSourceRange Range, StringRef Text) {
+    auto &SM = Rewrite.getSourceMgr();
+    auto FileRange = Lexer::makeFileCharRange(Range, SM,
+                                              Rewrite.getLangOpts());
+    if (FileRange.isInvalid()) return false;
+
+    FileID FID;
+    unsigned Begin, End;
+    std::tie(FID, Begin) = SM.getDecomposedLoc(FileRange.getBegin());
+    End = SM.getFileOffset(FileRange.getEnd());
+
+    auto &FileEdits = Edits[FID];
+    auto It = FileEdits.lower_bound(Begin);
+    if (It != FileEdits.end() && It->first < End) return false;
+    if (It != FileEdits.begin() && std::prev(It)->second > Begin)
+      return false;
+
+    if (Rewrite.ReplaceText(FileRange.getBegin(), End - Begin, Text))
+      return false;
+    FileEdits.insert(It, {Begin, End});
+    return true;
+  }
+
+  /// Return true on failure.
+  bool overwriteChangedFiles() {
+    return Rewrite.overwriteChangedFiles();
+  }
+};
+
+/// Only keep the candidates that are hot and whose branches are taken
+/// close to half of the time, since those are the ones mispredicted the
+/// most. The survivors are reported by descending misprediction cost.
+class TernaryProfileFilter {
+  std::unique_ptr<BranchProfile> Profile;
+  uint64_t HotThreshold;
+  /// Maximum distance of the taken ratio from 0.5
+  double MaxBias;
+
+  using ReportFn = std::function<void(const BranchStats&)>;
+  std::vector<std::pair<BranchStats, ReportFn>> Pending;
+
+public:
+  TernaryProfileFilter(std::unique_ptr<BranchProfile> Profile,
+                       uint64_t HotThreshold, double MaxBias)
+    : Profile(std::move(Profile)), HotThreshold(HotThreshold),
+      MaxBias(MaxBias) {}
+
+  void add(const IfStmt *If, const FunctionDecl *FD, ASTContext &Ctx,
+           ReportFn Report) {
+    auto Stats = Profile->getBranchStats(If, FD, Ctx);
+    if (!Stats || Stats->Count < HotThreshold ||
+        std::abs(Stats->TakenRatio - 0.5) > MaxBias)
+      return;
+    Pending.emplace_back(*Stats, std::move(Report));
+  }
+
+  void reportAll() {
+    llvm::stable_sort(Pending, [](const auto &LHS, const auto &RHS) {
+      return LHS.first.getMispredictions() > RHS.first.getMispredictions();
+    });
+    for (auto &P : Pending)
+      P.second(P.first);
+    Pending.clear();
+  }
+};
+} // end namespace clang
+
+TernaryConverterAction::~TernaryConverterAction() = default;
+
 bool TernaryConverterAction::ParseArgs(const CompilerInstance &CI,
                                        const std::vector<std::string> &Args) {
+  auto& Diag = CI.getDiagnostics();
   for (const auto &Arg : Args) {
+    StringRef ArgRef(Arg);
     if (Arg == "-no-detect-assignment") NoAssignment = true;
     if (Arg == "-no-detect-return") NoReturn = true;
+    if (Arg == "-apply-fixes") ApplyFixes = true;
+    if (ArgRef.consume_front("-profile="))
+      ProfilePath = ArgRef.str();
+    if ((ArgRef.consume_front("-hot-threshold=") &&
+         ArgRef.getAsInteger(10, HotThreshold)) ||
+        (ArgRef.consume_front("-max-bias=") &&
+         (ArgRef.getAsInteger(10, MaxBias) || MaxBias > 50))) {
+      Diag.Report(Diag.getCustomDiagID(DiagnosticsEngine::Error,
+                                       "invalid plugin argument '%0'"))
+        << Arg;
+      return false;
+    }
   }
   return true;
 }
 
-static StatementMatcher buildReturnMatcher(StringRef Suffix) {
-  auto Tag = ("return" + Suffix).str();
-  return compoundStmt(statementCountIs(1),
-                      hasAnySubstatement(
-                        returnStmt(
-                          hasReturnValue(expr().bind(Tag)))));
-}
-
-static StatementMatcher buildAssignmentMatcher(StringRef Suffix) {
-  auto TagDest = ("dest" + Suffix).str();
-  auto TagVal = ("val" + Suffix).str();
-  return compoundStmt(statementCountIs(1),
-                      hasAnySubstatement(
-                        binaryOperator(hasOperatorName("="),
-                                       hasLHS(declRefExpr().bind(TagDest)),
-                                       hasRHS(expr().bind(TagVal))
-                                       )
-                      ));
-}
-
-static StatementMatcher buildIfStmtMatcher(StatementMatcher trueBodyMatcher,
-                                           StatementMatcher falseBodyMatcher) {
-  return ifStmt(hasThen(trueBodyMatcher),
-                hasElse(falseBodyMatcher)).bind("if_stmt");
+/// Get the source text of \p E, parenthesized if it can't be an operand
+/// of the ternary operator as-is. Return an empty string if \p E comes
+/// from a macro or its text can't be read.
+static std::string getOperandText(const Expr *E, const ASTContext &Ctx) {
+  auto Range = E->getSourceRange();
+  if (Range.getBegin().isMacroID() || Range.getEnd().isMacroID())
+    return "";
+  auto Text = Lexer::getSourceText(CharSourceRange::getTokenRange(Range),
+                                   Ctx.getSourceManager(),
+                                   Ctx.getLangOpts()).str();
+  if (Text.empty()) return "";
+  const auto *Inner = E->IgnoreImplicit();
+  bool NeedParens = isa<AbstractConditionalOperator>(Inner);
+  if (const auto *BO = dyn_cast<BinaryOperator>(Inner))
+    NeedParens = BO->isAssignmentOp() || BO->isCommaOp();
+  return NeedParens? "(" + Text + ")" : Text;
 }
 
 namespace {
@@ -50,48 +153,143 @@ struct MatchCallbackBase : public MatchFinder::MatchCallback {
 
 protected:
   unsigned diag_warn_potential_ternary,
+           diag_warn_hot_ternary,
            diag_note_true_expr,
            diag_note_false_expr;
 
-  MatchCallbackBase(unsigned DiagMain,
-                    unsigned DiagTrueBr, unsigned DiagFalseBr)
+  /// Non-null if fixes should be applied
+  TernaryFixItApplier *FixApplier;
+  /// Non-null if a profile is used
+  TernaryProfileFilter *ProfileFilter;
+
+  MatchCallbackBase(unsigned DiagMain, unsigned DiagHot,
+                    unsigned DiagTrueBr, unsigned DiagFalseBr,
+                    TernaryFixItApplier *FixApplier,
+                    TernaryProfileFilter *ProfileFilter)
     : diag_warn_potential_ternary(DiagMain),
+      diag_warn_hot_ternary(DiagHot),
       diag_note_true_expr(DiagTrueBr),
-      diag_note_false_expr(DiagFalseBr) {}
+      diag_note_false_expr(DiagFalseBr),
+      FixApplier(FixApplier),
+      ProfileFilter(ProfileFilter) {}
+
+  /// Report \p If now, or hand it to the profile filter if there is one.
+  void handleIfStmt(const IfStmt *If, std::string Prefix,
+                    const Expr *TrueExpr, const Expr *FalseExpr,
+                    const MatchFinder::MatchResult &Result) {
+    auto &Ctx = *Result.Context;
+    if (!ProfileFilter) {
+      reportIfStmt(If, Prefix, TrueExpr, FalseExpr, nullptr, Ctx);
+      return;
+    }
+
+    const auto *FD = Result.Nodes.getNodeAs<FunctionDecl>("func");
+    if (!If || !FD) return;
+    ProfileFilter->add(If, FD, Ctx,
+                       [=, &Ctx](const BranchStats &Stats) {
+                         reportIfStmt(If, Prefix, TrueExpr, FalseExpr,
+                                      &Stats, Ctx);
+                       });
+  }
+
+  /// Report \p If as a ternary candidate, along with the execution
+  /// profile in \p Stats if there is one. If fixes are enabled, also
+  /// rewrite it into `<Prefix>cond ? TrueExpr : FalseExpr;`.
+  void reportIfStmt(const IfStmt *If, StringRef Prefix,
+                    const Expr *TrueExpr, const Expr *FalseExpr,
+                    const BranchStats *Stats, ASTContext &Ctx) {
+    auto& Diag = Ctx.getDiagnostics();
+    if (!If) {
+      Diag.Report(diag_warn_potential_ternary);
+      return;
+    }
+
+    {
+      auto DB = Diag.Report(If->getBeginLoc(),
+                            Stats? diag_warn_hot_ternary
+                                 : diag_warn_potential_ternary);
+      if (Stats)
+        DB << std::to_string(Stats->Count)
+           << llvm::formatv("{0:F1}%", Stats->TakenRatio * 100.0).str()
+           << llvm::formatv("{0:F0}", Stats->getMispredictions()).str();
+      addFixIt(DB, If, Prefix, TrueExpr, FalseExpr, Ctx);
+    }
+
+    if (TrueExpr && FalseExpr) {
+      Diag.Report(TrueExpr->getBeginLoc(), diag_note_true_expr);
+      Diag.Report(FalseExpr->getBeginLoc(), diag_note_false_expr);
+    }
+  }
+
+  /// Attach the ternary rewrite of \p If to \p DB if it's safe.
+  void addFixIt(DiagnosticBuilder &DB, const IfStmt *If, StringRef Prefix,
+                const Expr *TrueExpr, const Expr *FalseExpr,
+                ASTContext &Ctx) {
+    if (!FixApplier || !TrueExpr || !FalseExpr) return;
+
+    // Only a rewrite that is a guaranteed branchless select is safe:
+    // both arms have to be free of side effects and have the same type,
+    // so that no new conversion is introduced.
+    if (If->getInit() || If->getConditionVariable() || If->isConstexpr())
+      return;
+    if (TrueExpr->HasSideEffects(Ctx) || FalseExpr->HasSideEffects(Ctx))
+      return;
+    if (!Ctx.hasSameType(TrueExpr->getType(), FalseExpr->getType()))
+      return;
+
+    // Operands that can't be spelled out would leave holes in the
+    // rewrite, only warn about those
+    auto CondText = getOperandText(If->getCond(), Ctx),
+         TrueText = getOperandText(TrueExpr, Ctx),
+         FalseText = getOperandText(FalseExpr, Ctx);
+    if (Prefix.empty() || CondText.empty() || TrueText.empty() ||
+        FalseText.empty())
+      return;
+
+    std::string Text;
+    llvm::raw_string_ostream OS(Text);
+    OS << Prefix << CondText << " ? " << TrueText << " : " << FalseText;
+    // The semicolon of a non-compound else branch is not part of
+    // its source range
+    if (isa<CompoundStmt>(If->getElse()))
+      OS << ";";
+    OS.flush();
+
+    auto Range = CharSourceRange::getTokenRange(If->getBeginLoc(),
+                                                If->getElse()->getEndLoc());
+    if (FixApplier->replace(Range, Text))
+      DB << FixItHint::CreateReplacement(Range, Text);
+  }
 };
 
 struct MatchReturnCallback : public MatchCallbackBase {
-  MatchReturnCallback(unsigned DiagMain,
-                      unsigned DiagTrueBr, unsigned DiagFalseBr)
-    : MatchCallbackBase(DiagMain, DiagTrueBr, DiagFalseBr) {}
+  MatchReturnCallback(unsigned DiagMain, unsigned DiagHot,
+                      unsigned DiagTrueBr, unsigned DiagFalseBr,
+                      TernaryFixItApplier *FixApplier,
+                      TernaryProfileFilter *ProfileFilter)
+    : MatchCallbackBase(DiagMain, DiagHot, DiagTrueBr, DiagFalseBr,
+                        FixApplier, ProfileFilter) {}
 
   void run(const MatchFinder::MatchResult &Result) override {
     const auto& Nodes = Result.Nodes;
-    auto& Diag = Result.Context->getDiagnostics();
 
     const auto* If = Nodes.getNodeAs<IfStmt>("if_stmt");
-    if (If)
-      Diag.Report(If->getBeginLoc(), diag_warn_potential_ternary);
-    else
-      Diag.Report(diag_warn_potential_ternary);
-
     const auto* TrueRetExpr = Nodes.getNodeAs<Expr>("return.true");
     const auto* FalseRetExpr = Nodes.getNodeAs<Expr>("return.false");
-    if (TrueRetExpr && FalseRetExpr) {
-      Diag.Report(TrueRetExpr->getBeginLoc(), diag_note_true_expr);
-      Diag.Report(FalseRetExpr->getBeginLoc(), diag_note_false_expr);
-    }
+    handleIfStmt(If, "return ", TrueRetExpr, FalseRetExpr, Result);
   }
 };
 
 struct MatchAssignmentCallback : public MatchCallbackBase {
-  MatchAssignmentCallback(unsigned DiagMain,
-                          unsigned DiagTrueBr, unsigned DiagFalseBr)
-    : MatchCallbackBase(DiagMain, DiagTrueBr, DiagFalseBr) {}
+  MatchAssignmentCallback(unsigned DiagMain, unsigned DiagHot,
+                          unsigned DiagTrueBr, unsigned DiagFalseBr,
+                          TernaryFixItApplier *FixApplier,
+                          TernaryProfileFilter *ProfileFilter)
+    : MatchCallbackBase(DiagMain, DiagHot, DiagTrueBr, DiagFalseBr,
+                        FixApplier, ProfileFilter) {}
 
   void run(const MatchFinder::MatchResult &Result) override {
     const auto& Nodes = Result.Nodes;
-    auto& Diag = Result.Context->getDiagnostics();
 
     // Check if destination of both assignments are the same
     const auto *DestTrue = Nodes.getNodeAs<DeclRefExpr>("dest.true"),
@@ -100,21 +298,50 @@ struct MatchAssignmentCallback : public MatchCallbackBase {
       if (DestTrue->getDecl() == DestFalse->getDecl()) {
         // Can be converted to ternary!
         const auto* If = Nodes.getNodeAs<IfStmt>("if_stmt");
-        if (If)
-          Diag.Report(If->getBeginLoc(), diag_warn_potential_ternary);
-        else
-          Diag.Report(diag_warn_potential_ternary);
-
         const auto* TrueValExpr = Nodes.getNodeAs<Expr>("val.true");
         const auto* FalseValExpr = Nodes.getNodeAs<Expr>("val.false");
-        if (TrueValExpr && FalseValExpr) {
-          Diag.Report(TrueValExpr->getBeginLoc(), diag_note_true_expr);
-          Diag.Report(FalseValExpr->getBeginLoc(), diag_note_false_expr);
-        }
+        // Left empty, and so not rewritten, if the destination can't be
+        // spelled out
+        auto Prefix = getOperandText(DestTrue, *Result.Context);
+        if (!Prefix.empty())
+          Prefix += " = ";
+        handleIfStmt(If, Prefix, TrueValExpr, FalseValExpr, Result);
       }
     }
   }
 };
+
+/// Run the matchers over the translation unit, then report the profiled
+/// candidates and write the rewritten files. This can't wait for
+/// `EndSourceFileAction`: the diagnostic consumer is already done with
+/// the source file by then.
+class TernaryConverterConsumer : public ASTConsumer {
+  std::unique_ptr<ASTConsumer> MatchConsumer;
+  TernaryProfileFilter *ProfileFilter;
+  TernaryFixItApplier *FixApplier;
+
+public:
+  TernaryConverterConsumer(std::unique_ptr<ASTConsumer> MatchConsumer,
+                           TernaryProfileFilter *ProfileFilter,
+                           TernaryFixItApplier *FixApplier)
+    : MatchConsumer(std::move(MatchConsumer)),
+      ProfileFilter(ProfileFilter), FixApplier(FixApplier) {}
+
+  void HandleTranslationUnit(ASTContext &Ctx) override {
+    MatchConsumer->HandleTranslationUnit(Ctx);
+
+    // Profiled candidates are reported at once, sorted by their cost.
+    // Their fixes are only recorded then.
+    if (ProfileFilter)
+      ProfileFilter->reportAll();
+
+    if (FixApplier && FixApplier->overwriteChangedFiles()) {
+      auto &Diag = Ctx.getDiagnostics();
+      Diag.Report(Diag.getCustomDiagID(DiagnosticsEngine::Error,
+                                       "failed to write the rewritten files"));
+    }
+  }
+};
 } // end anonymous namespace
 
 std::unique_ptr<ASTConsumer>
@@ -126,6 +353,10 @@ TernaryConverterAction::CreateASTConsumer(CompilerInstance &CI,
   auto DiagWarnMain = Diag.getCustomDiagID(
     DiagnosticsEngine::Warning,
     "this if statement can be converted to ternary operator:");
+  auto DiagWarnHot = Diag.getCustomDiagID(
+    DiagnosticsEngine::Warning,
+    "this hot if statement can be converted to ternary operator "
+    "(executed %0 times, taken %1, ~%2 mispredictions):");
   auto DiagNoteTrueExpr = Diag.getCustomDiagID(
     DiagnosticsEngine::Note,
     "with true expression being this:");
@@ -133,31 +364,72 @@ TernaryConverterAction::CreateASTConsumer(CompilerInstance &CI,
     DiagnosticsEngine::Note,
     "with false expression being this:");
 
+  if (ApplyFixes)
+    FixApplier = std::make_unique<TernaryFixItApplier>(CI.getSourceManager(),
+                                                       CI.getLangOpts());
+
+  if (!ProfilePath.empty()) {
+    auto ProfileOrErr = BranchProfile::create(ProfilePath);
+    if (!ProfileOrErr) {
+      // Instrumented profiles can't be mapped back to the source
+      // without the coverage mapping, so only sample profiles work
+      Diag.Report(Diag.getCustomDiagID(DiagnosticsEngine::Error,
+                                       "failed to load sample profile "
+                                       "'%0': %1"))
+        << ProfilePath << ProfileOrErr.getError().message();
+      return nullptr;
+    }
+    ProfileFilter = std::make_unique<TernaryProfileFilter>(
+                      std::move(*ProfileOrErr), HotThreshold,
+                      MaxBias / 100.0);
+  }
+
+  // The profile is looked up by the enclosing function
+  auto withFunction = [this](StatementMatcher IfMatcher) -> StatementMatcher {
+    if (!ProfileFilter) return IfMatcher;
+    return stmt(IfMatcher, hasAncestor(functionDecl().bind("func")));
+  };
+
   ASTFinder = std::make_unique<MatchFinder>();
 
   // Return matcher
   if (!NoReturn) {
     ReturnMatchCB = std::make_unique<MatchReturnCallback>(DiagWarnMain,
+                                                          DiagWarnHot,
                                                           DiagNoteTrueExpr,
-                                                          DiagNoteFalseExpr);
+                                                          DiagNoteFalseExpr,
+                                                          FixApplier.get(),
+                                                          ProfileFilter.get());
     ASTFinder->addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
-                                   buildIfStmtMatcher(buildReturnMatcher(".true"),
-                                                      buildReturnMatcher(".false"))),
+                                   withFunction(
+                                     buildIfStmtMatcher(buildReturnMatcher(".true"),
+                                                        buildReturnMatcher(".false")))),
                           ReturnMatchCB.get());
   }
 
   // Assignment matcher
   if (!NoAssignment) {
     AssignMatchCB = std::make_unique<MatchAssignmentCallback>(DiagWarnMain,
+                                                              DiagWarnHot,
                                                               DiagNoteTrueExpr,
-                                                              DiagNoteFalseExpr);
+                                                              DiagNoteFalseExpr,
+                                                              FixApplier.get(),
+                                                              ProfileFilter.get());
     ASTFinder->addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
-                                   buildIfStmtMatcher(buildAssignmentMatcher(".true"),
-                                                      buildAssignmentMatcher(".false"))),
+                                   withFunction(
+                                     buildIfStmtMatcher(buildAssignmentMatcher(".true"),
+                                                        buildAssignmentMatcher(".false")))),
                           AssignMatchCB.get());
   }
 
-  return std::move(ASTFinder->newASTConsumer());
+  return std::make_unique<TernaryConverterConsumer>(
+           ASTFinder->newASTConsumer(), ProfileFilter.get(),
+           FixApplier.get());
+}
+
+void TernaryConverterAction::EndSourceFileAction() {
+  ProfileFilter.reset();
+  FixApplier.reset();
 }
 
 static FrontendPluginRegistry::Add<TernaryConverterAction>
@@ -2,10 +2,14 @@
 #define TERNARY_CONVERTER_H
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Frontend/FrontendAction.h"
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace clang {
+class TernaryFixItApplier;
+class TernaryProfileFilter;
+
 struct TernaryConverterAction : public PluginASTAction {
   std::unique_ptr<ASTConsumer>
     CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override;
@@ -17,6 +21,10 @@ struct TernaryConverterAction : public PluginASTAction {
     return Cmdline;
   }
 
+  void EndSourceFileAction() override;
+
+  ~TernaryConverterAction() override;
+
 private:
   /// By default this plugin will detect whether return statement
   /// and simple assignment in an if statement can be converted into
@@ -24,6 +32,19 @@ private:
   /// either of the feature.
   bool NoAssignment = false;
   bool NoReturn = false;
+  /// Attach fix-its to the warnings and rewrite the source files in
+  /// place.
+  bool ApplyFixes = false;
+
+  /// Sample profile used to only report hot branches taken about half
+  /// of the time, that is, at least `HotThreshold` times and with a
+  /// taken ratio no further than `MaxBias` percent from 50%.
+  std::string ProfilePath;
+  uint64_t HotThreshold = 1000;
+  unsigned MaxBias = 20;
+
+  std::unique_ptr<TernaryFixItApplier> FixApplier;
+  std::unique_ptr<TernaryProfileFilter> ProfileFilter;
 
   std::unique_ptr<ast_matchers::MatchFinder> ASTFinder;
   std::unique_ptr<ast_matchers::MatchFinder::MatchCallback> ReturnMatchCB,
@@ -0,0 +1,520 @@
+#include "TernaryMatchers.h"
+#include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace clang;
+using namespace ast_matchers;
+using namespace tooling;
+using namespace llvm;
+
+static cl::OptionCategory TernaryCategory("ternary-converter options");
+
+static cl::opt<unsigned>
+NumThreads("j", cl::init(0), cl::cat(TernaryCategory),
+           cl::desc("Number of worker threads (0 = all cores)"));
+
+static cl::opt<std::string>
+CachePath("cache", cl::init(".ternary-converter.cache"),
+          cl::cat(TernaryCategory),
+          cl::desc("File that records the results of the previous run. "
+                   "Pass an empty string to always analyze every TU"));
+
+static cl::opt<bool>
+NoAssignment("no-detect-assignment", cl::init(false),
+             cl::cat(TernaryCategory),
+             cl::desc("Do not report simple assignments"));
+
+static cl::opt<bool>
+NoReturn("no-detect-return", cl::init(false), cl::cat(TernaryCategory),
+         cl::desc("Do not report return statements"));
+
+namespace {
+struct Finding {
+  std::string File;
+  unsigned Line, Column;
+  std::string Kind;
+
+  bool operator<(const Finding &Other) const {
+    return std::tie(File, Line, Column, Kind) <
+           std::tie(Other.File, Other.Line, Other.Column, Other.Kind);
+  }
+};
+
+/// A file the TU depends on, with the modification time and size it
+/// had when the TU was analyzed.
+struct Dependency {
+  std::string File;
+  int64_t ModTime;
+  uint64_t Size;
+};
+
+struct TUResult {
+  /// All the compile commands for this TU, joined
+  std::string Command;
+  std::vector<Dependency> Deps;
+  /// Files the TU looked for without finding them, mostly in the header
+  /// search paths. Creating any of them can change what's included.
+  std::vector<std::string> Missing;
+  std::vector<Finding> Findings;
+};
+
+/// Stat results shared by all the workers. Negative results are cached
+/// too, since most of the lookups made by header searches fail.
+class SharedStatCache {
+  std::mutex Mutex;
+  StringMap<ErrorOr<vfs::Status>> Entries;
+
+public:
+  ErrorOr<vfs::Status>
+  lookup(StringRef Path, function_ref<ErrorOr<vfs::Status>()> Compute) {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      auto It = Entries.find(Path);
+      if (It != Entries.end()) return It->second;
+    }
+    auto Result = Compute();
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Entries.try_emplace(Path, Result).first->second;
+  }
+
+  Optional<ErrorOr<vfs::Status>> find(StringRef Path) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto It = Entries.find(Path);
+    if (It == Entries.end()) return None;
+    return It->second;
+  }
+
+  void insert(StringRef Path, ErrorOr<vfs::Status> Result) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Entries.try_emplace(Path, std::move(Result));
+  }
+};
+
+/// The file system used by each worker. It keeps its own working
+/// directory, since every compile command can have a different one,
+/// and only shares the stat cache, keyed by absolute paths.
+class CachingStatFileSystem : public vfs::ProxyFileSystem {
+  SharedStatCache &Cache;
+  /// Where the files that can't be found are recorded, if anywhere
+  StringSet<> *Missing = nullptr;
+
+  bool getAbsolutePath(const Twine &Path, SmallVectorImpl<char> &AbsPath) {
+    Path.toVector(AbsPath);
+    if (makeAbsolute(AbsPath))
+      return false;
+    sys::path::remove_dots(AbsPath, /*remove_dot_dot=*/false);
+    return true;
+  }
+
+public:
+  CachingStatFileSystem(SharedStatCache &Cache,
+                        IntrusiveRefCntPtr<vfs::FileSystem> FS)
+    : ProxyFileSystem(std::move(FS)), Cache(Cache) {}
+
+  void recordMissing(StringSet<> *Set) { Missing = Set; }
+
+  ErrorOr<vfs::Status> status(const Twine &Path) override {
+    SmallString<256> AbsPath;
+    if (!getAbsolutePath(Path, AbsPath))
+      return ProxyFileSystem::status(Path);
+    auto Result = Cache.lookup(AbsPath, [&] {
+                                 return ProxyFileSystem::status(AbsPath);
+                               });
+    if (!Result) {
+      if (Missing) Missing->insert(AbsPath);
+      return Result;
+    }
+    // Callers expect the name they asked for
+    return vfs::Status::copyWithNewName(*Result, Path);
+  }
+
+  // The header search opens the candidates instead of stat-ing them,
+  // so the misses are answered from the cache here too, and the status
+  // of the opened files is cached for the later stats.
+  ErrorOr<std::unique_ptr<vfs::File>>
+  openFileForRead(const Twine &Path) override {
+    SmallString<256> AbsPath;
+    if (!getAbsolutePath(Path, AbsPath))
+      return ProxyFileSystem::openFileForRead(Path);
+    if (auto Cached = Cache.find(AbsPath))
+      if (!*Cached) {
+        if (Missing) Missing->insert(AbsPath);
+        return Cached->getError();
+      }
+
+    auto Result = ProxyFileSystem::openFileForRead(Path);
+    if (!Result) {
+      Cache.insert(AbsPath, Result.getError());
+      if (Missing) Missing->insert(AbsPath);
+      return Result;
+    }
+    if (auto Status = (*Result)->status())
+      Cache.insert(AbsPath, *Status);
+    return Result;
+  }
+};
+
+/// Return a stable name for the file containing \p Loc, so that the
+/// same header reached from different TUs is only reported once.
+static std::string getFileName(SourceLocation Loc, const SourceManager &SM) {
+  const auto *FE = SM.getFileEntryForID(SM.getFileID(Loc));
+  if (!FE) return SM.getFilename(Loc).str();
+  StringRef RealPath = FE->tryGetRealPathName();
+  return (RealPath.empty()? FE->getName() : RealPath).str();
+}
+
+struct RecordCallback : public MatchFinder::MatchCallback {
+  std::vector<Finding> &Findings;
+  StringRef Kind;
+
+  RecordCallback(std::vector<Finding> &Findings, StringRef Kind)
+    : Findings(Findings), Kind(Kind) {}
+
+  void run(const MatchFinder::MatchResult &Result) override {
+    const auto &Nodes = Result.Nodes;
+    const auto *If = Nodes.getNodeAs<IfStmt>("if_stmt");
+    if (!If) return;
+
+    // Same as the plugin: both assignments need the same destination
+    const auto *DestTrue = Nodes.getNodeAs<DeclRefExpr>("dest.true"),
+               *DestFalse = Nodes.getNodeAs<DeclRefExpr>("dest.false");
+    if (DestTrue && DestFalse &&
+        DestTrue->getDecl() != DestFalse->getDecl())
+      return;
+
+    auto &SM = *Result.SourceManager;
+    auto Loc = SM.getFileLoc(If->getBeginLoc());
+    if (SM.isInSystemHeader(Loc)) return;
+    Findings.push_back({getFileName(Loc, SM),
+                        SM.getSpellingLineNumber(Loc),
+                        SM.getSpellingColumnNumber(Loc),
+                        Kind.str()});
+  }
+};
+
+/// Run the matchers and record every file the TU read.
+class TernaryAuditAction : public ASTFrontendAction {
+  TUResult &Result;
+  MatchFinder Finder;
+  std::unique_ptr<RecordCallback> ReturnCB, AssignCB;
+
+public:
+  explicit TernaryAuditAction(TUResult &Result) : Result(Result) {
+    if (!NoReturn) {
+      ReturnCB = std::make_unique<RecordCallback>(Result.Findings, "return");
+      Finder.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
+                                 buildIfStmtMatcher(buildReturnMatcher(".true"),
+                                                    buildReturnMatcher(".false"))),
+                        ReturnCB.get());
+    }
+    if (!NoAssignment) {
+      AssignCB = std::make_unique<RecordCallback>(Result.Findings,
+                                                  "assignment");
+      Finder.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
+                                 buildIfStmtMatcher(buildAssignmentMatcher(".true"),
+                                                    buildAssignmentMatcher(".false"))),
+                        AssignCB.get());
+    }
+  }
+
+  std::unique_ptr<ASTConsumer>
+  CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override {
+    return Finder.newASTConsumer();
+  }
+
+  void EndSourceFileAction() override {
+    auto &SM = getCompilerInstance().getSourceManager();
+    for (auto It = SM.fileinfo_begin(), E = SM.fileinfo_end(); It != E; ++It) {
+      const FileEntry *FE = It->first;
+      SmallString<256> Path(FE->tryGetRealPathName());
+      if (Path.empty()) {
+        Path = FE->getName();
+        getCompilerInstance().getVirtualFileSystem().makeAbsolute(Path);
+      }
+      Result.Deps.push_back({Path.str().str(),
+                             static_cast<int64_t>(FE->getModificationTime()),
+                             static_cast<uint64_t>(FE->getSize())});
+    }
+  }
+};
+
+struct TernaryAuditActionFactory : public FrontendActionFactory {
+  TUResult &Result;
+
+  explicit TernaryAuditActionFactory(TUResult &Result) : Result(Result) {}
+
+  std::unique_ptr<FrontendAction> create() override {
+    return std::make_unique<TernaryAuditAction>(Result);
+  }
+};
+} // end anonymous namespace
+
+static std::string getCommandKey(const CompilationDatabase &DB,
+                                 StringRef File) {
+  std::string Key;
+  raw_string_ostream OS(Key);
+  for (const auto &Cmd : DB.getCompileCommands(File)) {
+    OS << Cmd.Directory;
+    for (const auto &Arg : Cmd.CommandLine)
+      OS << " " << Arg;
+    OS << "\n";
+  }
+  return OS.str();
+}
+
+static bool isUpToDate(const TUResult &Cached, StringRef Command,
+                       vfs::FileSystem &FS) {
+  if (Cached.Command != Command || Cached.Deps.empty()) return false;
+  for (const auto &Dep : Cached.Deps) {
+    auto Status = FS.status(Dep.File);
+    if (!Status ||
+        sys::toTimeT(Status->getLastModificationTime()) != Dep.ModTime ||
+        Status->getSize() != Dep.Size)
+      return false;
+  }
+  // A new header can shadow the one that was included
+  for (const auto &File : Cached.Missing)
+    if (FS.status(File))
+      return false;
+  return true;
+}
+
+static std::map<std::string, TUResult> loadCache(StringRef Path) {
+  std::map<std::string, TUResult> Cache;
+  auto Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer) return Cache;
+  auto Root = json::parse((*Buffer)->getBuffer());
+  if (!Root) {
+    consumeError(Root.takeError());
+    return Cache;
+  }
+
+  const auto *TUs = Root->getAsObject();
+  if (!TUs) return Cache;
+  for (const auto &Entry : *TUs) {
+    const auto *Obj = Entry.second.getAsObject();
+    if (!Obj) continue;
+    TUResult TU;
+    if (auto Cmd = Obj->getString("command"))
+      TU.Command = Cmd->str();
+    if (const auto *Deps = Obj->getArray("deps"))
+      for (const auto &D : *Deps) {
+        const auto *DO = D.getAsObject();
+        if (!DO) continue;
+        TU.Deps.push_back({DO->getString("file").getValueOr("").str(),
+                           DO->getInteger("mtime").getValueOr(-1),
+                           static_cast<uint64_t>(
+                             DO->getInteger("size").getValueOr(-1))});
+      }
+    if (const auto *Missing = Obj->getArray("missing"))
+      for (const auto &M : *Missing)
+        if (auto File = M.getAsString())
+          TU.Missing.push_back(File->str());
+    if (const auto *Findings = Obj->getArray("findings"))
+      for (const auto &F : *Findings) {
+        const auto *FO = F.getAsObject();
+        if (!FO) continue;
+        TU.Findings.push_back({FO->getString("file").getValueOr("").str(),
+                               static_cast<unsigned>(
+                                 FO->getInteger("line").getValueOr(0)),
+                               static_cast<unsigned>(
+                                 FO->getInteger("column").getValueOr(0)),
+                               FO->getString("kind").getValueOr("").str()});
+      }
+    Cache[Entry.first.str()] = std::move(TU);
+  }
+  return Cache;
+}
+
+static void saveCache(StringRef Path,
+                      const std::map<std::string, TUResult> &Results) {
+  json::Object TUs;
+  for (const auto &Entry : Results) {
+    const auto &TU = Entry.second;
+    json::Array Deps, Missing, Findings;
+    for (const auto &D : TU.Deps)
+      Deps.push_back(json::Object{{"file", D.File},
+                                  {"mtime", D.ModTime},
+                                  {"size", static_cast<int64_t>(D.Size)}});
+    for (const auto &M : TU.Missing)
+      Missing.push_back(M);
+    for (const auto &F : TU.Findings)
+      Findings.push_back(json::Object{{"file", F.File},
+                                      {"line", F.Line},
+                                      {"column", F.Column},
+                                      {"kind", F.Kind}});
+    TUs[Entry.first] = json::Object{{"command", TU.Command},
+                                    {"deps", std::move(Deps)},
+                                    {"missing", std::move(Missing)},
+                                    {"findings", std::move(Findings)}};
+  }
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Failed to write cache " << Path << ": " << EC.message() << "\n";
+    return;
+  }
+  OS << json::Value(std::move(TUs));
+}
+
+/// Build directory given with CommonOptionsParser's -p, or the current
+/// directory
+static std::string getBuildPath() {
+  auto &Options = cl::getRegisteredOptions();
+  auto It = Options.find("p");
+  if (It != Options.end()) {
+    const auto &BuildPath = *static_cast<cl::opt<std::string> *>(It->second);
+    if (!BuildPath.empty()) return BuildPath;
+  }
+  return ".";
+}
+
+int main(int argc, const char **argv) {
+  // Files are optional, see below
+  auto OptionsParser = CommonOptionsParser::create(argc, argv,
+                                                   TernaryCategory,
+                                                   cl::ZeroOrMore);
+  if (!OptionsParser) {
+    errs() << toString(OptionsParser.takeError());
+    return 1;
+  }
+
+  // Analyze the files given on the command line, or everything in the
+  // compilation database. CommonOptionsParser only loads the database
+  // when it's given files.
+  std::vector<std::string> Files = OptionsParser->getSourcePathList();
+  std::unique_ptr<CompilationDatabase> AllFilesDB;
+  if (Files.empty()) {
+    std::string ErrorMessage;
+    AllFilesDB = CompilationDatabase::autoDetectFromDirectory(getBuildPath(),
+                                                              ErrorMessage);
+    if (!AllFilesDB) {
+      errs() << "Failed to load the compilation database: " << ErrorMessage
+             << "\n";
+      return 1;
+    }
+    Files = AllFilesDB->getAllFiles();
+  }
+  const CompilationDatabase &DB =
+    AllFilesDB? *AllFilesDB : OptionsParser->getCompilations();
+
+  std::map<std::string, TUResult> Cache;
+  if (!CachePath.empty())
+    Cache = loadCache(CachePath);
+
+  SharedStatCache StatCache;
+  std::mutex ResultsMutex, OutputMutex;
+  std::map<std::string, TUResult> Results;
+  std::atomic<unsigned> NumSkipped(0), NumFailed(0);
+  {
+    ThreadPool Pool(hardware_concurrency(NumThreads));
+    for (const auto &File : Files) {
+      Pool.async([&](std::string File) {
+        auto Command = getCommandKey(DB, File);
+        // Each worker needs its own working directory
+        IntrusiveRefCntPtr<CachingStatFileSystem> FS(
+          new CachingStatFileSystem(StatCache,
+                                    vfs::createPhysicalFileSystem().release()));
+
+        auto CachedIt = Cache.find(File);
+        if (CachedIt != Cache.end() &&
+            isUpToDate(CachedIt->second, Command, *FS)) {
+          ++NumSkipped;
+          std::lock_guard<std::mutex> Lock(ResultsMutex);
+          Results[File] = CachedIt->second;
+          return;
+        }
+
+        TUResult Result;
+        Result.Command = std::move(Command);
+        StringSet<> Missing;
+        FS->recordMissing(&Missing);
+
+        // The diagnostics of each TU are printed at once, so that those
+        // of concurrent TUs don't interleave
+        std::string DiagText;
+        raw_string_ostream DiagOS(DiagText);
+        IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts(new DiagnosticOptions());
+        TextDiagnosticPrinter DiagPrinter(DiagOS, DiagOpts.get());
+
+        ClangTool Tool(DB, {File}, std::make_shared<PCHContainerOperations>(),
+                       FS);
+        Tool.setDiagnosticConsumer(&DiagPrinter);
+        Tool.setPrintErrorMessage(false);
+        TernaryAuditActionFactory Factory(Result);
+        bool Failed = Tool.run(&Factory);
+        if (Failed)
+          DiagOS << "Error while processing " << File << ".\n";
+        if (!DiagOS.str().empty()) {
+          std::lock_guard<std::mutex> Lock(OutputMutex);
+          errs() << DiagOS.str();
+        }
+        if (Failed) {
+          ++NumFailed;
+          return;
+        }
+
+        for (const auto &Entry : Missing)
+          Result.Missing.push_back(Entry.getKey().str());
+        llvm::sort(Result.Missing);
+
+        std::lock_guard<std::mutex> Lock(ResultsMutex);
+        Results[File] = std::move(Result);
+      }, File);
+    }
+    Pool.wait();
+  }
+
+  // TUs outside of this run keep their entries, so that running on a
+  // few files doesn't throw away the results of the others
+  if (!CachePath.empty()) {
+    for (const auto &File : Files)
+      Cache.erase(File);
+    for (const auto &Entry : Results)
+      Cache[Entry.first] = Entry.second;
+    saveCache(CachePath, Cache);
+  }
+
+  // Merge the findings. Headers included by many TUs show up once.
+  std::set<Finding> Report;
+  for (const auto &Entry : Results)
+    Report.insert(Entry.second.Findings.begin(),
+                  Entry.second.Findings.end());
+  for (const auto &F : Report)
+    outs() << F.File << ":" << F.Line << ":" << F.Column
+           << ": warning: this if statement can be converted to ternary "
+              "operator (" << F.Kind << ")\n";
+
+  errs() << "Analyzed " << (Results.size() - NumSkipped) << " TUs, skipped "
+         << NumSkipped << " unchanged TUs, " << NumFailed << " failed. "
+         << Report.size() << " candidates found\n";
+  return NumFailed? 1 : 0;
+}
@@ -0,0 +1,32 @@
+#include "TernaryMatchers.h"
+
+using namespace clang;
+using namespace ast_matchers;
+
+/// Match either a single statement or a compound statement that only
+/// contains it.
+static StatementMatcher buildBodyMatcher(StatementMatcher StmtMatcher) {
+  return stmt(anyOf(compoundStmt(statementCountIs(1),
+                                 hasAnySubstatement(StmtMatcher)),
+                    StmtMatcher));
+}
+
+StatementMatcher clang::buildReturnMatcher(StringRef Suffix) {
+  auto Tag = ("return" + Suffix).str();
+  return buildBodyMatcher(returnStmt(hasReturnValue(expr().bind(Tag))));
+}
+
+StatementMatcher clang::buildAssignmentMatcher(StringRef Suffix) {
+  auto TagDest = ("dest" + Suffix).str();
+  auto TagVal = ("val" + Suffix).str();
+  return buildBodyMatcher(binaryOperator(hasOperatorName("="),
+                                         hasLHS(declRefExpr().bind(TagDest)),
+                                         hasRHS(expr().bind(TagVal))
+                                         ));
+}
+
+StatementMatcher clang::buildIfStmtMatcher(StatementMatcher trueBodyMatcher,
+                                           StatementMatcher falseBodyMatcher) {
+  return ifStmt(hasThen(trueBodyMatcher),
+                hasElse(falseBodyMatcher)).bind("if_stmt");
+}
@@ -0,0 +1,21 @@
+#ifndef TERNARY_MATCHERS_H
+#define TERNARY_MATCHERS_H
+#include "clang/ASTMatchers/ASTMatchers.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clang {
+/// Match a return statement, whose value is bound to "return<Suffix>",
+/// either alone or in a compound statement.
+ast_matchers::StatementMatcher buildReturnMatcher(llvm::StringRef Suffix);
+
+/// Match a simple assignment, whose destination and value are bound to
+/// "dest<Suffix>" and "val<Suffix>", either alone or in a compound
+/// statement.
+ast_matchers::StatementMatcher buildAssignmentMatcher(llvm::StringRef Suffix);
+
+/// Match an if statement, bound to "if_stmt", with both branches.
+ast_matchers::StatementMatcher
+buildIfStmtMatcher(ast_matchers::StatementMatcher trueBodyMatcher,
+                   ast_matchers::StatementMatcher falseBodyMatcher);
+} // end namespace clang
+#endif
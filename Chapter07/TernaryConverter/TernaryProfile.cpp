@@ -0,0 +1,77 @@
+#include "TernaryProfile.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Mangle.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ProfileData/SampleProf.h"
+#include "llvm/ProfileData/SampleProfReader.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace llvm::sampleprof;
+
+ErrorOr<std::unique_ptr<BranchProfile>>
+BranchProfile::create(StringRef Path) {
+  std::unique_ptr<BranchProfile> Profile(new BranchProfile());
+  auto ReaderOrErr = SampleProfileReader::create(Path.str(),
+                                                 Profile->LLVMCtx);
+  if (!ReaderOrErr) return ReaderOrErr.getError();
+  Profile->Reader = std::move(*ReaderOrErr);
+  if (auto EC = Profile->Reader->read()) return EC;
+  return std::move(Profile);
+}
+
+BranchProfile::~BranchProfile() = default;
+
+uint64_t BranchProfile::getLineCount(const FunctionSamples &FS,
+                                     unsigned LineOffset) {
+  auto Inserted = LineCounts.try_emplace(&FS);
+  auto &Counts = Inserted.first->second;
+  if (Inserted.second) {
+    // Different discriminators on the same line are different blocks,
+    // the hottest one is the closest to the line's execution count.
+    for (const auto &Sample : FS.getBodySamples()) {
+      auto &Count = Counts[Sample.first.LineOffset];
+      Count = std::max(Count, Sample.second.getSamples());
+    }
+  }
+  return Counts.lookup(LineOffset);
+}
+
+/// Strip the compound statement around a single-statement branch.
+static const Stmt *getBranchBody(const Stmt *S) {
+  if (const auto *CS = dyn_cast<CompoundStmt>(S))
+    if (CS->size() == 1)
+      return CS->body_front();
+  return S;
+}
+
+Optional<BranchStats> BranchProfile::getBranchStats(const IfStmt *If,
+                                                    const FunctionDecl *FD,
+                                                    ASTContext &Ctx) {
+  if (!If->getElse()) return None;
+  if (!Mangler)
+    Mangler = std::make_unique<ASTNameGenerator>(Ctx);
+  const auto *FS = Reader->getSamplesFor(Mangler->getName(FD));
+  if (!FS) return None;
+
+  // Sample profiles use line offsets from the line of the function's
+  // name, which is also the line of its DISubprogram
+  auto &SM = Ctx.getSourceManager();
+  auto getLine = [&](SourceLocation Loc) {
+    return SM.getPresumedLineNumber(SM.getExpansionLoc(Loc));
+  };
+  unsigned FuncLine = getLine(FD->getLocation()),
+           IfLine = getLine(If->getBeginLoc()),
+           ThenLine = getLine(getBranchBody(If->getThen())->getBeginLoc()),
+           ElseLine = getLine(getBranchBody(If->getElse())->getBeginLoc());
+  if (IfLine < FuncLine || ThenLine == IfLine || ElseLine == ThenLine)
+    return None;
+
+  uint64_t ThenCount = getLineCount(*FS, ThenLine - FuncLine),
+           ElseCount = getLineCount(*FS, ElseLine - FuncLine);
+  uint64_t Count = ThenCount + ElseCount;
+  if (!Count) return BranchStats{0, 0.0};
+  return BranchStats{Count, static_cast<double>(ThenCount) / Count};
+}
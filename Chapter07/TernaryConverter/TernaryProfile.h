@@ -0,0 +1,67 @@
+#ifndef TERNARY_PROFILE_H
+#define TERNARY_PROFILE_H
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/ErrorOr.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+namespace llvm {
+namespace sampleprof {
+class FunctionSamples;
+class SampleProfileReader;
+} // end namespace sampleprof
+} // end namespace llvm
+
+namespace clang {
+class ASTContext;
+class ASTNameGenerator;
+class FunctionDecl;
+class IfStmt;
+
+struct BranchStats {
+  /// Number of times either of the branches was executed
+  uint64_t Count;
+  /// Fraction of the executions that took the true branch
+  double TakenRatio;
+
+  /// Estimated number of mispredictions, assuming the predictor always
+  /// guesses the more likely branch.
+  double getMispredictions() const {
+    return Count * std::min(TakenRatio, 1.0 - TakenRatio);
+  }
+};
+
+/// Map if statements back to the line counts in a sample profile.
+class BranchProfile {
+  llvm::LLVMContext LLVMCtx;
+  std::unique_ptr<llvm::sampleprof::SampleProfileReader> Reader;
+  std::unique_ptr<ASTNameGenerator> Mangler;
+  /// Maximum count on each line offset, for every function looked up
+  llvm::DenseMap<const llvm::sampleprof::FunctionSamples*,
+                 llvm::DenseMap<unsigned, uint64_t>> LineCounts;
+
+  BranchProfile() = default;
+
+  uint64_t getLineCount(const llvm::sampleprof::FunctionSamples &FS,
+                        unsigned LineOffset);
+
+public:
+  /// Load a sample profile, either AutoFDO text or any of the binary
+  /// sample profile formats.
+  static llvm::ErrorOr<std::unique_ptr<BranchProfile>>
+  create(llvm::StringRef Path);
+
+  ~BranchProfile();
+
+  /// Return None if there is no profile for \p If, or the branches
+  /// can't be told apart by their lines.
+  llvm::Optional<BranchStats> getBranchStats(const IfStmt *If,
+                                             const FunctionDecl *FD,
+                                             ASTContext &Ctx);
+};
+} // end namespace clang
+#endif
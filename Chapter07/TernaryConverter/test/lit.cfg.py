@@ -0,0 +1,15 @@
+import os
+
+import lit.formats
+
+config.name = 'TernaryConverter'
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = ['.c']
+config.test_source_root = os.path.dirname(__file__)
+
+config.substitutions.append(
+    ('%load_ternary_converter',
+     '-Xclang -load -Xclang {0} -Xclang -plugin -Xclang ternary-converter'
+     .format(config.ternary_converter_plugin)))
+config.environment['PATH'] = os.pathsep.join(
+    [config.llvm_tools_dir, config.environment.get('PATH', '')])
@@ -0,0 +1,61 @@
+// Operands coming from a macro are still reported, but not rewritten:
+// their source text can't be read back.
+// RUN: cp %s %t.c
+// RUN: clang -fsyntax-only %load_ternary_converter \
+// RUN:   -Xclang -plugin-arg-ternary-converter -Xclang -apply-fixes \
+// RUN:   %t.c 2>&1 | FileCheck %s --check-prefix=DIAG
+// RUN: FileCheck %s --input-file=%t.c
+
+#define ONE 1
+#define IS_SET(x) ((x) != 0)
+#define DEST y
+
+// DIAG: warning: this if statement can be converted to ternary operator
+// CHECK-LABEL: {{^}}int macroValue(
+// CHECK-NEXT: {{^}}  int x;
+// CHECK-NEXT: {{^}}  if (c)
+// CHECK-NEXT: {{^}}    x = ONE;
+int macroValue(int c) {
+  int x;
+  if (c)
+    x = ONE;
+  else
+    x = 2;
+  return x;
+}
+
+// DIAG: warning: this if statement can be converted to ternary operator
+// CHECK-LABEL: {{^}}int macroCond(
+// CHECK-NEXT: {{^}}  if (IS_SET(c))
+// CHECK-NEXT: {{^}}    return 1;
+int macroCond(int c) {
+  if (IS_SET(c))
+    return 1;
+  else
+    return 2;
+}
+
+// DIAG: warning: this if statement can be converted to ternary operator
+// CHECK-LABEL: {{^}}int macroDest(
+// CHECK-NEXT: {{^}}  int y;
+// CHECK-NEXT: {{^}}  if (c)
+// CHECK-NEXT: {{^}}    DEST = 1;
+int macroDest(int c) {
+  int y;
+  if (c)
+    DEST = 1;
+  else
+    DEST = 2;
+  return y;
+}
+
+// Operands spelled out in the source are still rewritten
+// DIAG: warning: this if statement can be converted to ternary operator
+// CHECK-LABEL: {{^}}int plain(
+// CHECK-NEXT: {{^}}  return c ? 1 : 2;
+int plain(int c) {
+  if (c)
+    return 1;
+  else
+    return 2;
+}
@@ -0,0 +1,303 @@
+//===----------------------------------------------------------------------===//
+/// Format the binary log written by simple_log.h in SLG_BINARY mode:
+/// \code
+/// simple-log-decode simple_log.bin [-o output.txt] [-level=info]
+/// \endcode
+//===----------------------------------------------------------------------===//
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/bit.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdio>
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFile(cl::Positional, cl::Required,
+                                      cl::desc("<simple log file>"));
+
+static cl::opt<std::string> OutputFile("o", cl::init("-"),
+                                       cl::desc("Output file"),
+                                       cl::value_desc("filename"));
+
+enum LogLevel { LL_Debug, LL_Info, LL_Error };
+static cl::opt<LogLevel> MinLevel(
+    "level", cl::init(LL_Debug), cl::desc("Only print records at this level or above"),
+    cl::values(clEnumValN(LL_Debug, "debug", "All records"),
+               clEnumValN(LL_Info, "info", "Info and error records"),
+               clEnumValN(LL_Error, "error", "Error records")));
+
+namespace {
+struct LogSite {
+  uint8_t Level;
+  uint32_t Line;
+  StringRef File, Format, Signature;
+};
+
+/// One argument of a record, as written by simple_log::writeArg
+struct LogArg {
+  char Code;
+  uint64_t Bits = 0;
+  StringRef Str;
+};
+
+class Reader {
+  StringRef Buffer;
+
+public:
+  explicit Reader(StringRef Buffer) : Buffer(Buffer) {}
+
+  bool empty() const { return Buffer.empty(); }
+
+  template <typename T> bool read(T &Val) {
+    if (Buffer.size() < sizeof(T))
+      return false;
+    Val = support::endian::read<T, support::native, 1>(Buffer.data());
+    Buffer = Buffer.drop_front(sizeof(T));
+    return true;
+  }
+
+  bool readBytes(size_t Size, StringRef &Bytes) {
+    if (Buffer.size() < Size)
+      return false;
+    Bytes = Buffer.take_front(Size);
+    Buffer = Buffer.drop_front(Size);
+    return true;
+  }
+
+  bool readString(StringRef &Str) {
+    uint32_t Len;
+    return read(Len) && readBytes(Len, Str);
+  }
+};
+} // end anonymous namespace
+
+static StringRef getLevelName(uint8_t Level) {
+  switch (Level) {
+  case LL_Debug:
+    return "DEBUG";
+  case LL_Info:
+    return "INFO";
+  default:
+    return "ERROR";
+  }
+}
+
+/// Format a single conversion \p Spec, without its length modifiers,
+/// with \p Arg converted to the type the conversion expects.
+static void formatArg(raw_ostream &OS, StringRef Spec, const LogArg &Arg) {
+  char Conv = Spec.back();
+  SmallString<16> Fmt(Spec.drop_back());
+  char Buf[512];
+  int Len;
+  auto AsDouble = [&] {
+    return Arg.Code == 'f' ? llvm::bit_cast<double>(Arg.Bits)
+                           : static_cast<double>(static_cast<int64_t>(Arg.Bits));
+  };
+  auto AsInt = [&] {
+    return Arg.Code == 'f' ? static_cast<uint64_t>(llvm::bit_cast<double>(Arg.Bits))
+                           : Arg.Bits;
+  };
+
+  switch (Conv) {
+  case 'd':
+  case 'i':
+    Fmt += "lld";
+    Len = snprintf(Buf, sizeof(Buf), Fmt.c_str(),
+                   static_cast<long long>(AsInt()));
+    break;
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+    (Fmt += "ll") += Conv;
+    Len = snprintf(Buf, sizeof(Buf), Fmt.c_str(),
+                   static_cast<unsigned long long>(AsInt()));
+    break;
+  case 'c':
+    Fmt += 'c';
+    Len = snprintf(Buf, sizeof(Buf), Fmt.c_str(), static_cast<int>(AsInt()));
+    break;
+  case 'p':
+    Fmt += 'p';
+    Len = snprintf(Buf, sizeof(Buf), Fmt.c_str(),
+                   reinterpret_cast<void *>(static_cast<uintptr_t>(AsInt())));
+    break;
+  case 's': {
+    // Copy to make it null-terminated
+    std::string Str = Arg.Code == 's' ? Arg.Str.str() : "(?)";
+    Fmt += 's';
+    Len = snprintf(Buf, sizeof(Buf), Fmt.c_str(), Str.c_str());
+    break;
+  }
+  default:
+    // e, f, g, a and their uppercase versions
+    Fmt += Conv;
+    Len = snprintf(Buf, sizeof(Buf), Fmt.c_str(), AsDouble());
+    break;
+  }
+  if (Len > 0)
+    OS << StringRef(Buf, std::min<size_t>(Len, sizeof(Buf) - 1));
+}
+
+/// Walk the printf conversions of \p Format, consuming one argument for
+/// each of them.
+static void formatRecord(raw_ostream &OS, StringRef Format,
+                         ArrayRef<LogArg> Args) {
+  while (!Format.empty()) {
+    size_t Percent = Format.find('%');
+    OS << Format.take_front(Percent);
+    if (Percent == StringRef::npos)
+      return;
+    Format = Format.drop_front(Percent);
+    if (Format.startswith("%%")) {
+      OS << '%';
+      Format = Format.drop_front(2);
+      continue;
+    }
+
+    // %[flags][width][.precision][length]conversion
+    size_t End = Format.find_first_of("diouxXcspaAeEfFgGn", 1);
+    if (End == StringRef::npos) {
+      OS << Format;
+      return;
+    }
+    SmallString<16> Spec;
+    for (char C : Format.slice(0, End)) {
+      if (StringRef("hljztL").contains(C))
+        continue;
+      if (C == '*') {
+        // Width or precision from an argument
+        if (!Args.empty()) {
+          Spec += std::to_string(static_cast<int64_t>(Args.front().Bits));
+          Args = Args.drop_front();
+        }
+        continue;
+      }
+      Spec += C;
+    }
+    Spec += Format[End];
+    Format = Format.drop_front(End + 1);
+
+    if (Spec.back() == 'n')
+      continue;
+    if (Args.empty()) {
+      OS << "<missing>";
+      continue;
+    }
+    formatArg(OS, Spec, Args.front());
+    Args = Args.drop_front();
+  }
+}
+
+static bool decode(StringRef Buffer, raw_ostream &OS) {
+  Reader R(Buffer);
+  StringRef Magic;
+  uint32_t Version;
+  if (!R.readBytes(4, Magic) || Magic != "SLGB" || !R.read(Version) ||
+      Version != 1) {
+    WithColor::error() << "not a simple log file\n";
+    return false;
+  }
+
+  DenseMap<uint64_t, LogSite> Sites;
+  DenseMap<uint64_t, uint64_t> Dropped;
+  SmallVector<LogArg, 8> Args;
+  while (!R.empty()) {
+    char Kind;
+    R.read(Kind);
+    switch (Kind) {
+    case 'F': {
+      uint64_t ID;
+      LogSite Site;
+      if (!R.read(ID) || !R.read(Site.Level) || !R.read(Site.Line) ||
+          !R.readString(Site.File) || !R.readString(Site.Format) ||
+          !R.readString(Site.Signature))
+        break;
+      Sites[ID] = Site;
+      continue;
+    }
+    case 'D': {
+      uint64_t ThreadID, Count;
+      if (!R.read(ThreadID) || !R.read(Count))
+        break;
+      Dropped[ThreadID] += Count;
+      continue;
+    }
+    case 'R': {
+      uint64_t ThreadID, SiteID, Nanos;
+      uint32_t Size;
+      StringRef Payload;
+      if (!R.read(ThreadID) || !R.read(Size) || Size < 20 ||
+          !R.readBytes(Size - 4, Payload))
+        break;
+      Reader Rec(Payload);
+      Rec.read(SiteID);
+      Rec.read(Nanos);
+      auto It = Sites.find(SiteID);
+      if (It == Sites.end()) {
+        WithColor::error() << "record of unknown site " << SiteID << "\n";
+        return false;
+      }
+      const LogSite &Site = It->second;
+      if (Site.Level < MinLevel)
+        continue;
+
+      Args.clear();
+      for (char Code : Site.Signature) {
+        LogArg Arg;
+        Arg.Code = Code;
+        if (!(Code == 's' ? Rec.readString(Arg.Str) : Rec.read(Arg.Bits)))
+          break;
+        Args.push_back(Arg);
+      }
+
+      char Time[32];
+      snprintf(Time, sizeof(Time), "%llu.%09llu",
+               static_cast<unsigned long long>(Nanos / 1000000000),
+               static_cast<unsigned long long>(Nanos % 1000000000));
+      OS << Time << " T" << ThreadID << " [" << getLevelName(Site.Level)
+         << "] " << Site.File << ":" << Site.Line << ": ";
+      formatRecord(OS, Site.Format, Args);
+      OS << "\n";
+      continue;
+    }
+    default:
+      break;
+    }
+    WithColor::error() << "truncated or corrupted simple log file\n";
+    return false;
+  }
+
+  for (const auto &Entry : Dropped)
+    WithColor::warning() << "thread " << Entry.first << " dropped "
+                         << Entry.second << " records, its buffer was full\n";
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Simple log decoder\n");
+
+  auto BufferOrErr = MemoryBuffer::getFileOrSTDIN(InputFile);
+  if (!BufferOrErr) {
+    WithColor::error() << "failed to read " << InputFile << ": "
+                       << BufferOrErr.getError().message() << "\n";
+    return 1;
+  }
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error() << "failed to open " << OutputFile << ": "
+                       << EC.message() << "\n";
+    return 1;
+  }
+  return decode((*BufferOrErr)->getBuffer(), OS) ? 0 : 1;
+}
@@ -0,0 +1,682 @@
+#ifndef SIMPLE_LOG_H
+#define SIMPLE_LOG_H
+/// Force-included by the driver when simple log is enabled, with
+/// `SLG_ENABLE_{DEBUG,INFO,ERROR}` defined for the enabled levels.
+///
+/// Calls of disabled levels still have their format checked, but
+/// don't generate any code. Enabled calls print to stderr, or, with
+/// -fsimple-log-format=binary (`SLG_BINARY`) in C++, write a binary
+/// record that is formatted offline by `simple-log-decode`.
+///
+/// Enabled calls can also be sampled or rate limited, which is checked
+/// with counters of each call site in each thread. The number of records
+/// each site dropped is printed at exit.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SLG_LEVEL_DEBUG 0
+#define SLG_LEVEL_INFO 1
+#define SLG_LEVEL_ERROR 2
+
+// Never called, it only checks the format against its arguments
+static inline void slg_check_format(const char *Fmt, ...)
+    __attribute__((format(printf, 1, 2), unused));
+static inline void slg_check_format(const char *Fmt, ...) { (void)Fmt; }
+
+#define SLG_DISABLED(...)                                                     \
+  do {                                                                        \
+    if (0)                                                                    \
+      slg_check_format(__VA_ARGS__);                                          \
+  } while (0)
+
+// Sampling and rate limiting from -fsimple-log-sample=<level>:<keep>/<period>
+// and -fsimple-log-rate-limit=<level>:<rate>/s, for each level
+#ifndef SLG_SAMPLE_DEBUG_PERIOD
+#define SLG_SAMPLE_DEBUG_KEEP 1
+#define SLG_SAMPLE_DEBUG_PERIOD 1
+#endif
+#ifndef SLG_SAMPLE_INFO_PERIOD
+#define SLG_SAMPLE_INFO_KEEP 1
+#define SLG_SAMPLE_INFO_PERIOD 1
+#endif
+#ifndef SLG_SAMPLE_ERROR_PERIOD
+#define SLG_SAMPLE_ERROR_KEEP 1
+#define SLG_SAMPLE_ERROR_PERIOD 1
+#endif
+#ifndef SLG_RATE_LIMIT_DEBUG
+#define SLG_RATE_LIMIT_DEBUG 0
+#endif
+#ifndef SLG_RATE_LIMIT_INFO
+#define SLG_RATE_LIMIT_INFO 0
+#endif
+#ifndef SLG_RATE_LIMIT_ERROR
+#define SLG_RATE_LIMIT_ERROR 0
+#endif
+
+/// Records dropped by one call site in one thread
+struct slg_dropped {
+  const char *File;
+  unsigned Line;
+  uint64_t Sampled, Limited;
+  struct slg_dropped *Next;
+};
+
+/// Sampling and rate-limiting state of one call site in one thread, so
+/// that the checks never write to memory shared with other threads.
+/// Zero-initialized, which is an empty bucket that is refilled on the
+/// first call.
+struct slg_limiter {
+  uint32_t Count;
+  uint32_t Tokens;
+  uint64_t LastRefill;
+  struct slg_dropped *Dropped;
+};
+
+// Sites of this translation unit that dropped records, never freed
+static struct slg_dropped *slg_dropped_list __attribute__((unused));
+
+static void slg_report_dropped(void) __attribute__((unused));
+static void slg_report_dropped(void) {
+  struct slg_dropped *Head =
+      __atomic_load_n(&slg_dropped_list, __ATOMIC_ACQUIRE);
+  struct slg_dropped *D, *Other;
+  for (D = Head; D; D = D->Next) {
+    uint64_t Sampled = 0, Limited = 0;
+    // Merge all the threads into the first entry of the site
+    for (Other = Head; Other != D; Other = Other->Next)
+      if (Other->Line == D->Line && !strcmp(Other->File, D->File))
+        break;
+    if (Other != D)
+      continue;
+    for (; Other; Other = Other->Next)
+      if (Other->Line == D->Line && !strcmp(Other->File, D->File)) {
+        Sampled += __atomic_load_n(&Other->Sampled, __ATOMIC_RELAXED);
+        Limited += __atomic_load_n(&Other->Limited, __ATOMIC_RELAXED);
+      }
+    fprintf(stderr,
+            "simple log: %s:%u dropped %llu records (%llu sampled out, "
+            "%llu rate limited)\n",
+            D->File, D->Line, (unsigned long long)(Sampled + Limited),
+            (unsigned long long)Sampled, (unsigned long long)Limited);
+  }
+}
+
+static void slg_drop(struct slg_limiter *L, int Sampled, const char *File,
+                     unsigned Line) __attribute__((noinline, cold, unused));
+static void slg_drop(struct slg_limiter *L, int Sampled, const char *File,
+                     unsigned Line) {
+  uint64_t *Counter;
+  if (!L->Dropped) {
+    struct slg_dropped *D =
+        (struct slg_dropped *)calloc(1, sizeof(struct slg_dropped));
+    if (!D)
+      return;
+    D->File = File;
+    D->Line = Line;
+    D->Next = __atomic_load_n(&slg_dropped_list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&slg_dropped_list, &D->Next, D, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+    // Only the first site of the list registers the report
+    if (!D->Next)
+      atexit(slg_report_dropped);
+    L->Dropped = D;
+  }
+  // Only written by this thread
+  Counter = Sampled ? &L->Dropped->Sampled : &L->Dropped->Limited;
+  __atomic_store_n(Counter, __atomic_load_n(Counter, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+static inline uint64_t slg_now(void) {
+#if defined(CLOCK_MONOTONIC_COARSE)
+  struct timespec TS;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &TS);
+  return (uint64_t)TS.tv_sec * 1000000000 + TS.tv_nsec;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec TS;
+  clock_gettime(CLOCK_MONOTONIC, &TS);
+  return (uint64_t)TS.tv_sec * 1000000000 + TS.tv_nsec;
+#else
+  // Strict ISO C without POSIX clocks
+  return (uint64_t)time(NULL) * 1000000000;
+#endif
+}
+
+/// Refill the token bucket once it's empty, so that the clock is only
+/// read once every \p Rate records at most.
+static int slg_refill(struct slg_limiter *L, uint32_t Rate)
+    __attribute__((noinline, unused));
+static int slg_refill(struct slg_limiter *L, uint32_t Rate) {
+  uint64_t Now = slg_now(), Elapsed, Tokens;
+  Elapsed = Now - L->LastRefill;
+  if (!L->LastRefill || Elapsed >= 1000000000) {
+    // The bucket holds one second worth of records
+    L->Tokens = Rate;
+    L->LastRefill = Now;
+    return 1;
+  }
+  Tokens = Elapsed * Rate / 1000000000;
+  if (!Tokens)
+    return 0;
+  L->Tokens = (uint32_t)Tokens;
+  // Keep the remainder for the next refill
+  L->LastRefill += Tokens * 1000000000 / Rate;
+  return 1;
+}
+
+/// Whether the call site of \p L may emit a record. Without sampling or
+/// rate limiting this folds to true, otherwise the fast path is a
+/// thread-local counter and a thread-local token count.
+static inline int slg_admit(struct slg_limiter *L, uint32_t Keep,
+                            uint32_t Period, uint32_t Rate, const char *File,
+                            unsigned Line) {
+  if (Period > 1) {
+    uint32_t C = L->Count;
+    L->Count = C + 1 == Period ? 0 : C + 1;
+    if (C >= Keep) {
+      slg_drop(L, 1, File, Line);
+      return 0;
+    }
+  }
+  if (Rate) {
+    if (!L->Tokens && !slg_refill(L, Rate)) {
+      slg_drop(L, 0, File, Line);
+      return 0;
+    }
+    --L->Tokens;
+  }
+  return 1;
+}
+
+// `Level` is only pasted, so that it's never expanded if the program has
+// a macro of the same name
+#define SLG_EMIT_LIMITED(Level, Emit)                                         \
+  do {                                                                        \
+    static __thread struct slg_limiter SLGLimiter;                            \
+    if (slg_admit(&SLGLimiter, SLG_SAMPLE_##Level##_KEEP,                     \
+                  SLG_SAMPLE_##Level##_PERIOD, SLG_RATE_LIMIT_##Level,        \
+                  __FILE__, __LINE__))                                        \
+      Emit;                                                                   \
+  } while (0)
+
+#if defined(SLG_BINARY) && defined(__cplusplus)
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+// Bytes buffered by each thread, a power of two
+#ifndef SLG_BUFFER_SIZE
+#define SLG_BUFFER_SIZE (1 << 20)
+#endif
+
+namespace simple_log {
+/// A log statement, its address is the ID of the format in the records
+struct Site {
+  uint8_t Level;
+  uint32_t Line;
+  const char *File;
+  const char *Format;
+  /// One character for each argument: 'i'nteger, 'f'loat, 's'tring or
+  /// 'p'ointer
+  const char *Signature;
+};
+
+template <typename T> struct ArgCode {
+  static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+                    std::is_pointer<T>::value,
+                "unsupported simple log argument");
+  static constexpr char Value =
+      std::is_same<T, char *>::value || std::is_same<T, const char *>::value
+          ? 's'
+      : std::is_pointer<T>::value        ? 'p'
+      : std::is_floating_point<T>::value ? 'f'
+                                         : 'i';
+};
+
+template <typename... Args> struct Signature {
+  static constexpr char Value[] = {ArgCode<Args>::Value..., '\0'};
+};
+template <typename... Args>
+constexpr char Signature<Args...>::Value[];
+
+/// Only used in decltype, to get the signature from the arguments
+/// without evaluating them
+template <typename... Args>
+Signature<typename std::decay<Args>::type...>
+makeSignature(const char *Fmt, const Args &...);
+
+/// Strings longer than this are truncated
+constexpr uint32_t MaxStringSize = 1024;
+
+/// Single-producer single-consumer ring buffer: only its thread writes
+/// records, only the flush thread reads them. The two sides never
+/// write to the same cache line.
+struct Ring {
+  static constexpr uint64_t Capacity = SLG_BUFFER_SIZE;
+  static_assert((Capacity & (Capacity - 1)) == 0, "not a power of two");
+
+  // Written by the owning thread
+  alignas(64) std::atomic<uint64_t> Head{0};
+  uint64_t CachedTail = 0;
+  std::atomic<uint64_t> Dropped{0};
+  // Written by the flush thread
+  alignas(64) std::atomic<uint64_t> Tail{0};
+  uint64_t FlushedDropped = 0;
+
+  alignas(64) std::atomic<bool> Exited{false};
+  uint64_t ThreadID = 0;
+  Ring *Next = nullptr;
+  char Data[Capacity];
+
+  // The alignment above needs C++17 aligned new
+  static void *operator new(size_t Size) {
+    void *Ptr = nullptr;
+    if (posix_memalign(&Ptr, 64, Size))
+      throw std::bad_alloc();
+    return Ptr;
+  }
+  static void operator delete(void *Ptr) { std::free(Ptr); }
+
+  /// Reserve \p Size bytes, or return false if the flush thread is too
+  /// far behind.
+  bool reserve(uint64_t Size) {
+    uint64_t H = Head.load(std::memory_order_relaxed);
+    if (H + Size - CachedTail <= Capacity)
+      return true;
+    CachedTail = Tail.load(std::memory_order_acquire);
+    return H + Size - CachedTail <= Capacity;
+  }
+
+  void write(uint64_t &Pos, const void *Src, uint64_t Size) {
+    uint64_t Offset = Pos % Capacity;
+    uint64_t First = Size < Capacity - Offset ? Size : Capacity - Offset;
+    std::memcpy(Data + Offset, Src, First);
+    std::memcpy(Data, static_cast<const char *>(Src) + First, Size - First);
+    Pos += Size;
+  }
+
+  void read(uint64_t Pos, void *Dst, uint64_t Size) const {
+    uint64_t Offset = Pos % Capacity;
+    uint64_t First = Size < Capacity - Offset ? Size : Capacity - Offset;
+    std::memcpy(Dst, Data + Offset, First);
+    std::memcpy(static_cast<char *>(Dst) + First, Data, Size - First);
+  }
+};
+
+/// Every record is `u32 Size, u64 SiteID, u64 Nanoseconds` followed by
+/// the arguments: 8 bytes for each number, `u32 Length` plus the
+/// characters for each string.
+constexpr uint64_t RecordHeaderSize = 4 + 8 + 8;
+
+/// Drain all the rings into the log file from a background thread.
+/// The file, SIMPLE_LOG_FILE or simple_log.bin, is a sequence of
+/// entries:
+///  - 'F' u64 SiteID, u8 Level, u32 Line, then the file, the format and
+///    the signature, each as `u32 Length` plus the characters. It comes
+///    before the first record of the site.
+///  - 'R' u64 ThreadID, then the record as it is in the ring.
+///  - 'D' u64 ThreadID, u64 Count: more records dropped by the thread.
+class Logger {
+  std::mutex Lock;
+  std::condition_variable Wakeup;
+  bool Stopping = false;
+  /// Set once the last drain started, records logged after it are dropped
+  std::atomic<bool> Stopped{false};
+  Ring *Rings = nullptr;
+  uint64_t NextThreadID = 0;
+  FILE *File = nullptr;
+  /// Sites whose 'F' entry was written, only used by the flush thread
+  struct SeenSet {
+    const Site **Slots = nullptr;
+    uint64_t Size = 0, Capacity = 0;
+  } Seen;
+  std::thread Flusher;
+
+  void putBytes(const void *Src, size_t Size) { fwrite(Src, 1, Size, File); }
+  template <typename T> void put(T Val) { putBytes(&Val, sizeof(Val)); }
+  void putString(const char *Str) {
+    uint32_t Len = static_cast<uint32_t>(std::strlen(Str));
+    put(Len);
+    putBytes(Str, Len);
+  }
+
+  bool markSeen(const Site *S) {
+    if (Seen.Size * 2 >= Seen.Capacity) {
+      // Rehash into a table twice as large
+      SeenSet Old = Seen;
+      Seen.Capacity = Old.Capacity ? Old.Capacity * 2 : 256;
+      Seen.Slots = static_cast<const Site **>(
+          std::calloc(Seen.Capacity, sizeof(const Site *)));
+      Seen.Size = 0;
+      for (uint64_t I = 0; I < Old.Capacity; ++I)
+        if (Old.Slots[I])
+          markSeen(Old.Slots[I]);
+      std::free(Old.Slots);
+    }
+    uint64_t Hash = reinterpret_cast<uintptr_t>(S) >> 3;
+    for (uint64_t I = Hash;; ++I) {
+      const Site *&Slot = Seen.Slots[I & (Seen.Capacity - 1)];
+      if (Slot == S)
+        return false;
+      if (!Slot) {
+        Slot = S;
+        ++Seen.Size;
+        return true;
+      }
+    }
+  }
+
+  void drain(Ring &R) {
+    uint64_t Head = R.Head.load(std::memory_order_acquire);
+    uint64_t Pos = R.Tail.load(std::memory_order_relaxed);
+    char Record[RecordHeaderSize + 64 * (4 + MaxStringSize)];
+    while (Pos != Head) {
+      uint32_t Size;
+      R.read(Pos, &Size, sizeof(Size));
+      R.read(Pos, Record, Size);
+      const Site *S;
+      std::memcpy(&S, Record + 4, sizeof(S));
+      if (markSeen(S)) {
+        put('F');
+        put(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(S)));
+        put(S->Level);
+        put(S->Line);
+        putString(S->File);
+        putString(S->Format);
+        putString(S->Signature);
+      }
+      put('R');
+      put(R.ThreadID);
+      putBytes(Record, Size);
+      Pos += Size;
+    }
+    R.Tail.store(Pos, std::memory_order_release);
+
+    uint64_t Dropped = R.Dropped.load(std::memory_order_relaxed);
+    if (Dropped != R.FlushedDropped) {
+      put('D');
+      put(R.ThreadID);
+      put(Dropped - R.FlushedDropped);
+      R.FlushedDropped = Dropped;
+    }
+  }
+
+  /// Drain every ring, and free the ones whose thread is gone if
+  /// \p FreeExited.
+  void drainAll(bool FreeExited) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    for (Ring **Link = &Rings; *Link;) {
+      Ring *R = *Link;
+      bool Exited = R->Exited.load(std::memory_order_acquire);
+      drain(*R);
+      if (Exited && FreeExited) {
+        *Link = R->Next;
+        delete R;
+      } else {
+        Link = &R->Next;
+      }
+    }
+    fflush(File);
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> Guard(Lock);
+    while (!Stopping) {
+      Wakeup.wait_for(Guard, std::chrono::milliseconds(50));
+      Guard.unlock();
+      drainAll(/*FreeExited=*/true);
+      Guard.lock();
+    }
+  }
+
+  static void stopAtExit() {
+    Logger &L = get();
+    L.Stopped.store(true, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> Guard(L.Lock);
+      L.Stopping = true;
+    }
+    L.Wakeup.notify_one();
+    L.Flusher.join();
+    // Threads that are still running, or the destructors of this one
+    // running after its ring was handed over, may still hold their ring
+    L.drainAll(/*FreeExited=*/false);
+    fclose(L.File);
+  }
+
+  Logger() {
+    const char *Path = std::getenv("SIMPLE_LOG_FILE");
+    File = fopen(Path ? Path : "simple_log.bin", "wb");
+    if (!File)
+      File = stderr;
+    putBytes("SLGB", 4);
+    put(static_cast<uint32_t>(1));
+    Flusher = std::thread([this] { run(); });
+    std::atexit(stopAtExit);
+  }
+
+public:
+  /// Never destroyed, so that threads still logging at exit don't touch
+  /// a dead object
+  static Logger &get() {
+    static Logger *L = new Logger();
+    return *L;
+  }
+
+  bool isStopped() const { return Stopped.load(std::memory_order_acquire); }
+
+  Ring *createRing() {
+    // Not value-initialized, so that the pages of the data are only
+    // touched when they are written
+    Ring *R = new Ring;
+    std::lock_guard<std::mutex> Guard(Lock);
+    R->ThreadID = NextThreadID++;
+    R->Next = Rings;
+    Rings = R;
+    return R;
+  }
+};
+
+/// Set once the ring of the current thread is handed to the flush
+/// thread. Trivially destructible, so it stays valid for the destructors
+/// that run after the ring's, e.g. those of the globals in the main thread.
+inline bool &isThreadRingGone() {
+  static thread_local bool Gone = false;
+  return Gone;
+}
+
+/// The ring of the current thread, handed to the flush thread when the
+/// thread exits
+struct ThreadRing {
+  Ring *R = Logger::get().createRing();
+  ~ThreadRing() {
+    isThreadRingGone() = true;
+    R->Exited.store(true, std::memory_order_release);
+  }
+};
+
+/// The ring of the current thread, or null once it has been handed over
+inline Ring *getThreadRing() {
+  if (isThreadRingGone())
+    return nullptr;
+  static thread_local ThreadRing TR;
+  return TR.R;
+}
+
+inline uint32_t getStringSize(const char *Str) {
+  if (!Str)
+    return 0;
+  uint32_t Len = 0;
+  while (Len < MaxStringSize && Str[Len])
+    ++Len;
+  return Len;
+}
+
+/// The type an argument is written as. Strings are all written as
+/// `const char *`, be they literals, arrays or `char *`, the same way
+/// makeSignature decays them, so that the size of a record and what is
+/// written in it agree.
+template <typename T>
+using StoredArg = typename std::conditional<
+    ArgCode<typename std::decay<T>::type>::Value == 's', const char *,
+    typename std::decay<T>::type>::type;
+
+template <typename T> inline StoredArg<T> storeArg(const T &Arg) {
+  return Arg;
+}
+
+template <typename T> inline uint64_t getArgSize(const T &) { return 8; }
+inline uint64_t getArgSize(const char *Str) { return 4 + getStringSize(Str); }
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+writeArg(Ring &R, uint64_t &Pos, T Val) {
+  double D = Val;
+  R.write(Pos, &D, 8);
+}
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value ||
+                               std::is_enum<T>::value>::type
+writeArg(Ring &R, uint64_t &Pos, T Val) {
+  uint64_t I = static_cast<uint64_t>(Val);
+  R.write(Pos, &I, 8);
+}
+template <typename T>
+inline void writeArg(Ring &R, uint64_t &Pos, const T *Ptr) {
+  uint64_t P = reinterpret_cast<uintptr_t>(Ptr);
+  R.write(Pos, &P, 8);
+}
+inline void writeArg(Ring &R, uint64_t &Pos, const char *Str) {
+  uint32_t Len = getStringSize(Str);
+  R.write(Pos, &Len, 4);
+  R.write(Pos, Str, Len);
+}
+
+inline void writeArgs(Ring &, uint64_t &) {}
+template <typename T, typename... Rest>
+inline void writeArgs(Ring &R, uint64_t &Pos, const T &Arg,
+                      const Rest &...Args) {
+  writeArg(R, Pos, storeArg(Arg));
+  writeArgs(R, Pos, Args...);
+}
+
+/// Append a record to the ring of this thread, or drop it if the ring
+/// is full, or if logging already stopped at exit. No locks and no
+/// formatting, the format is the one of \p S.
+template <typename... Args>
+inline void log(const Site &S, const char *, const Args &...A) {
+  static_assert(sizeof...(Args) <= 64, "too many simple log arguments");
+  uint64_t Sizes[] = {0, getArgSize(storeArg(A))...};
+  uint64_t Size = RecordHeaderSize;
+  for (uint64_t ArgSize : Sizes)
+    Size += ArgSize;
+
+  if (Logger::get().isStopped())
+    return;
+  Ring *RP = getThreadRing();
+  if (!RP)
+    return;
+  Ring &R = *RP;
+  if (!R.reserve(Size)) {
+    R.Dropped.store(R.Dropped.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    return;
+  }
+  uint64_t Pos = R.Head.load(std::memory_order_relaxed);
+  uint32_t Size32 = static_cast<uint32_t>(Size);
+  const Site *SP = &S;
+  uint64_t Time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                      .count();
+  R.write(Pos, &Size32, 4);
+  R.write(Pos, &SP, 8);
+  R.write(Pos, &Time, 8);
+  writeArgs(R, Pos, A...);
+  R.Head.store(Pos, std::memory_order_release);
+}
+} // end namespace simple_log
+
+// The format, which is the first argument. The extra argument keeps
+// the `...` of SLG_FORMAT_ from being empty.
+#define SLG_FORMAT(...) SLG_FORMAT_(__VA_ARGS__, 0)
+#define SLG_FORMAT_(Fmt, ...) Fmt
+
+#define SLG_EMIT(Level, ...)                                                  \
+  do {                                                                        \
+    if (0)                                                                    \
+      slg_check_format(__VA_ARGS__);                                          \
+    static const ::simple_log::Site SLGSite = {                               \
+        SLG_LEVEL_##Level, __LINE__, __FILE__, SLG_FORMAT(__VA_ARGS__),       \
+        decltype(::simple_log::makeSignature(__VA_ARGS__))::Value};           \
+    ::simple_log::log(SLGSite, __VA_ARGS__);                                  \
+  } while (0)
+
+#else
+#define SLG_STRINGIFY(X) SLG_STRINGIFY_(X)
+#define SLG_STRINGIFY_(X) #X
+
+/// Print the record in a single call, so that the lines of different
+/// threads don't interleave
+static void slg_print(const char *Prefix, const char *Fmt, ...)
+    __attribute__((format(printf, 2, 3), unused));
+static void slg_print(const char *Prefix, const char *Fmt, ...) {
+  char Buffer[256], *Message = Buffer;
+  va_list Args, ArgsCopy;
+  int Len;
+  va_start(Args, Fmt);
+  va_copy(ArgsCopy, Args);
+  Len = vsnprintf(Buffer, sizeof(Buffer), Fmt, Args);
+  if (Len >= (int)sizeof(Buffer)) {
+    Message = (char *)malloc(Len + 1);
+    if (Message)
+      vsnprintf(Message, Len + 1, Fmt, ArgsCopy);
+    else
+      Message = Buffer; // Truncated
+  }
+  va_end(ArgsCopy);
+  va_end(Args);
+  fprintf(stderr, "%s%s\n", Prefix, Message);
+  if (Message != Buffer)
+    free(Message);
+}
+
+#define SLG_EMIT(Level, ...)                                                  \
+  slg_print("[" #Level "] " __FILE__ ":" SLG_STRINGIFY(__LINE__) ": ",        \
+            __VA_ARGS__)
+#endif
+
+#ifdef SLG_ENABLE_DEBUG
+#define SLG_DEBUG(...)                                                        \
+  SLG_EMIT_LIMITED(DEBUG, SLG_EMIT(DEBUG, __VA_ARGS__))
+#else
+#define SLG_DEBUG(...) SLG_DISABLED(__VA_ARGS__)
+#endif
+
+#ifdef SLG_ENABLE_INFO
+#define SLG_INFO(...)                                                         \
+  SLG_EMIT_LIMITED(INFO, SLG_EMIT(INFO, __VA_ARGS__))
+#else
+#define SLG_INFO(...) SLG_DISABLED(__VA_ARGS__)
+#endif
+
+#ifdef SLG_ENABLE_ERROR
+#define SLG_ERROR(...)                                                        \
+  SLG_EMIT_LIMITED(ERROR, SLG_EMIT(ERROR, __VA_ARGS__))
+#else
+#define SLG_ERROR(...) SLG_DISABLED(__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,13 @@
+// Log every kind of string argument, which must all be written as
+// strings and sized accordingly
+int main() {
+  char Array[] = "array";
+  char Buffer[] = "pointer";
+  char *Ptr = Buffer;
+  const char *ConstPtr = "const pointer";
+  SLG_INFO("%s %s %s %s %d", Array, Ptr, ConstPtr, "literal", 42);
+  // A record right after, which is misread if the previous one has the
+  // wrong size
+  SLG_INFO("next %d", 7);
+  return 0;
+}
@@ -0,0 +1,13 @@
+import os
+
+import lit.formats
+
+config.name = 'SimpleLog'
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = ['.test']
+config.test_source_root = os.path.dirname(__file__)
+
+# The decoder and the test programs, then FileCheck
+config.environment['PATH'] = os.pathsep.join(
+    config.simple_log_tools_dirs +
+    [config.llvm_tools_dir, config.environment.get('PATH', '')])
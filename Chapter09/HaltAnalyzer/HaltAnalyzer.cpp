@@ -1,62 +1,347 @@
+#include "HaltAnalyzer.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/BasicBlock.h"
-#include "llvm/IR/Dominators.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include <string>
+
+#define DEBUG_TYPE "halt-analyzer"
 
 using namespace llvm;
 
-namespace {
-class HaltAnalyzer : public PassInfoMixin<HaltAnalyzer> {
-  static constexpr const char* HaltFuncName = "my_halt";
+STATISTIC(NumHaltCallsPruned,
+          "Number of halting calls turned into terminators");
+STATISTIC(NumColdBranches, "Number of branches marked cold");
+STATISTIC(NumHaltFuncs, "Number of functions inferred as halting");
+STATISTIC(NumDeadBlocks, "Number of blocks dominated by halting calls");
+
+static cl::list<std::string>
+HaltFuncNames("halt-funcs", cl::CommaSeparated,
+              cl::desc("Names of functions that never return "
+                       "(default: my_halt)"));
+
+static cl::opt<bool>
+DeleteUnreachable("halt-prune-delete", cl::init(true),
+                  cl::desc("Delete blocks dominated by halting calls "
+                           "instead of only marking them cold"));
+
+static cl::opt<bool>
+PrintPropagationSummary("halt-propagation-summary", cl::init(false),
+                        cl::desc("Print the number of halting functions and "
+                                 "dead blocks found by HaltPropagation"));
+
+AnalysisKey HaltAnalysis::Key;
+
+bool HaltAnalysis::isHaltFunction(const Function &F) {
+  if (F.doesNotReturn() && F.hasFnAttribute(Attribute::Cold))
+    return true;
+  if (HaltFuncNames.empty())
+    return F.getName() == "my_halt";
+  return llvm::is_contained(HaltFuncNames, F.getName());
+}
+
+/// Return the first call to halting functions in \p BB, if there is any
+static CallBase *findHaltCall(BasicBlock &BB) {
+  for (auto &I : BB)
+    if (auto *CB = dyn_cast<CallBase>(&I)) {
+      // Indirect calls don't have callee
+      auto *Callee = CB->getCalledFunction();
+      if (Callee && HaltAnalysis::isHaltFunction(*Callee))
+        return CB;
+    }
+  return nullptr;
+}
+
+HaltInfo HaltAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
+  HaltInfo Info;
+  for (auto &BB : F)
+    if (findHaltCall(BB))
+      Info.HaltBlocks.push_back(&BB);
+  if (Info.HaltBlocks.empty()) return Info;
+
+  // Walk the CFG without going past halting calls, except through the
+  // unwind edges of invokes: the halting function might still throw.
+  // Dominance alone would also take the landing pads as unreachable.
+  SmallPtrSet<BasicBlock*, 16> Live;
+  SmallVector<BasicBlock*, 16> Worklist;
+  Worklist.push_back(&F.getEntryBlock());
+  Live.insert(&F.getEntryBlock());
+  while (!Worklist.empty()) {
+    auto *BB = Worklist.pop_back_val();
+    if (auto *CB = findHaltCall(*BB)) {
+      if (auto *II = dyn_cast<InvokeInst>(CB))
+        if (Live.insert(II->getUnwindDest()).second)
+          Worklist.push_back(II->getUnwindDest());
+      continue;
+    }
+    for (auto *Succ : successors(BB))
+      if (Live.insert(Succ).second)
+        Worklist.push_back(Succ);
+  }
+  // Blocks that were never reachable in the first place don't count
+  for (auto *BB : depth_first(&F.getEntryBlock()))
+    if (!Live.count(BB))
+      Info.UnreachableBlocks.insert(BB);
+  return Info;
+}
 
-  SmallVector<Instruction*, 2> Calls;
-  void findHaltCalls(Function &F);
+bool HaltInfo::invalidate(Function &F, const PreservedAnalyses &PA,
+                          FunctionAnalysisManager::Invalidator &) {
+  // Besides the CFG, the result depends on the calls and the attributes
+  // of their callees, which passes preserving the CFG can still change
+  auto PAC = PA.getChecker<HaltAnalysis>();
+  return !(PAC.preserved() || PAC.preservedSet<AllAnalysesOn<Function>>());
+}
 
-public:
-  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
-};
-} // end anonymous namespace
+void HaltInfo::print(raw_ostream &OS, const Function &F) const {
+  for (auto &BB : F)
+    if (isUnreachable(&BB)) {
+      BB.printAsOperand(OS << "Unreachable: ", false);
+      OS << "\n";
+    }
+}
 
 PreservedAnalyses
 HaltAnalyzer::run(Function &F, FunctionAnalysisManager &FAM) {
-  auto PA = PreservedAnalyses::all();
+  FAM.getResult<HaltAnalysis>(F).print(OS, F);
+  return PreservedAnalyses::all();
+}
 
-  findHaltCalls(F);
-  if (Calls.size() == 0) return PA;
-
-  DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
-  SmallVector<BasicBlock*, 4> DomBBs;
-  for (auto *I : Calls) {
-    auto *BB = I->getParent();
-    DomBBs.clear();
-    DT.getDescendants(BB, DomBBs);
-
-    for (auto *DomBB : DomBBs) {
-      // exclude self
-      if (DomBB != BB) {
-        DomBB->printAsOperand(errs() << "Unreachable: ");
-        errs() << "\n";
-      }
+/// Erase everything after \p I in its block and terminate the block
+/// with `unreachable` instead.
+static void terminateAfter(Instruction *I) {
+  BasicBlock *BB = I->getParent();
+  for (auto *Succ : successors(BB))
+    Succ->removePredecessor(BB);
+  while (&BB->back() != I) {
+    Instruction &Last = BB->back();
+    if (!Last.use_empty())
+      Last.replaceAllUsesWith(UndefValue::get(Last.getType()));
+    Last.eraseFromParent();
+  }
+  new UnreachableInst(BB->getContext(), BB);
+}
+
+/// Point the normal destination of \p II, which never returns, to a new
+/// block that only has `unreachable`. The unwind edge is left alone.
+/// Return false if the destination was already like that.
+static bool pruneNormalDest(InvokeInst *II) {
+  BasicBlock *Normal = II->getNormalDest();
+  if (isa<UnreachableInst>(Normal->getFirstNonPHIOrDbg()))
+    return false;
+  LLVMContext &Ctx = II->getContext();
+  auto *Dead = BasicBlock::Create(Ctx, "halt.unreachable",
+                                  II->getFunction(), Normal);
+  new UnreachableInst(Ctx, Dead);
+  Normal->removePredecessor(II->getParent());
+  II->setNormalDest(Dead);
+  return true;
+}
+
+PreservedAnalyses HaltPruner::run(Function &F, FunctionAnalysisManager &FAM) {
+  auto &HI = FAM.getResult<HaltAnalysis>(F);
+  if (HI.getHaltBlocks().empty())
+    return PreservedAnalyses::all();
+
+  bool CFGChanged = false, Changed = false;
+  MDBuilder MDB(F.getContext());
+  SmallPtrSet<BasicBlock*, 4> HaltBlocks(HI.getHaltBlocks().begin(),
+                                         HI.getHaltBlocks().end());
+  // Mark the edges into halting blocks as cold
+  for (auto &BB : F) {
+    auto *BI = dyn_cast<BranchInst>(BB.getTerminator());
+    if (!BI || !BI->isConditional() || BI->getMetadata(LLVMContext::MD_prof))
+      continue;
+    bool TrueCold = HaltBlocks.count(BI->getSuccessor(0)),
+         FalseCold = HaltBlocks.count(BI->getSuccessor(1));
+    if (TrueCold == FalseCold) continue;
+    BI->setMetadata(LLVMContext::MD_prof,
+                    TrueCold? MDB.createBranchWeights(1, (1U << 20) - 1)
+                            : MDB.createBranchWeights((1U << 20) - 1, 1));
+    NumColdBranches++;
+    Changed = true;
+  }
+
+  for (auto *BB : HI.getHaltBlocks()) {
+    auto *CB = findHaltCall(*BB);
+    if (!CB) continue;
+    if (!CB->hasFnAttr(Attribute::Cold) || !CB->doesNotReturn()) {
+      CB->addFnAttr(Attribute::Cold);
+      CB->addFnAttr(Attribute::NoReturn);
+      Changed = true;
+    }
+    if (!DeleteUnreachable) continue;
+    // An invoke is already the terminator, only its normal edge is dead
+    bool Pruned = false;
+    if (auto *II = dyn_cast<InvokeInst>(CB))
+      Pruned = pruneNormalDest(II);
+    else if (!isa<UnreachableInst>(CB->getNextNode())) {
+      terminateAfter(CB);
+      Pruned = true;
+    }
+    if (Pruned) {
+      NumHaltCallsPruned++;
+      CFGChanged = true;
     }
   }
+  // Blocks that were dominated by halting calls are now unreachable
+  if (CFGChanged)
+    removeUnreachableBlocks(F);
 
+  if (!Changed && !CFGChanged) return PreservedAnalyses::all();
+  PreservedAnalyses PA;
+  if (!CFGChanged) {
+    PA.preserveSet<CFGAnalyses>();
+    // Attributes on the calls don't matter, only those on the callees
+    PA.preserve<HaltAnalysis>();
+  }
   return PA;
 }
 
-void HaltAnalyzer::findHaltCalls(Function &F) {
-  Calls.clear();
-  for (auto &I : instructions(F)) {
-    if (auto *CI = dyn_cast<CallInst>(&I)) {
-      if (CI->getCalledFunction()->getName() == HaltFuncName)
-        Calls.push_back(&I);
+using FunctionSet = SmallPtrSetImpl<const Function*>;
+
+/// Return the callee of \p I if it's a call to a halting function, or
+/// to one of the functions in \p Assumed.
+static const Function *getHaltCallee(const Instruction &I,
+                                     const FunctionSet &Assumed) {
+  if (const auto *CB = dyn_cast<CallBase>(&I))
+    if (const auto *Callee = CB->getCalledFunction())
+      if (Assumed.count(Callee) || HaltAnalysis::isHaltFunction(*Callee))
+        return Callee;
+  return nullptr;
+}
+
+/// Return true if every path from the entry of \p F runs into a
+/// halting call before it can leave the function. Calls to functions in
+/// \p Assumed are treated as halting. \p CallsHalt is set if any of the
+/// halting calls targets a function outside of \p Assumed.
+static bool alwaysHalts(const Function &F, const FunctionSet &Assumed,
+                        bool &CallsHalt) {
+  SmallPtrSet<const BasicBlock*, 16> Visited;
+  SmallVector<const BasicBlock*, 16> Worklist;
+  Worklist.push_back(&F.getEntryBlock());
+  Visited.insert(&F.getEntryBlock());
+  while (!Worklist.empty()) {
+    const auto *BB = Worklist.pop_back_val();
+    const Instruction *HaltCall = nullptr;
+    for (const auto &I : *BB)
+      if (const auto *Callee = getHaltCallee(I, Assumed)) {
+        CallsHalt |= !Assumed.count(Callee);
+        HaltCall = &I;
+        break;
+      }
+
+    if (HaltCall) {
+      // The halting function might still throw
+      if (const auto *II = dyn_cast<InvokeInst>(HaltCall))
+        if (Visited.insert(II->getUnwindDest()).second)
+          Worklist.push_back(II->getUnwindDest());
+      continue;
     }
+    const auto *Term = BB->getTerminator();
+    if (isa<ReturnInst>(Term) || isa<ResumeInst>(Term) ||
+        isa<CleanupReturnInst>(Term))
+      return false;
+    for (const auto *Succ : successors(BB))
+      if (Visited.insert(Succ).second)
+        Worklist.push_back(Succ);
+  }
+  return true;
+}
+
+/// Find the functions in \p SCC that always halt. Recursive calls are
+/// optimistically assumed to halt, and the assumption is retracted from
+/// every function that turns out to return, revisiting its callers.
+static void findHaltingFunctions(ArrayRef<Function*> SCC,
+                                 SmallPtrSetImpl<const Function*> &Halting) {
+  Halting.insert(SCC.begin(), SCC.end());
+  SmallVector<const Function*, 4> Worklist(SCC.begin(), SCC.end());
+  while (!Worklist.empty()) {
+    const auto *F = Worklist.pop_back_val();
+    bool CallsHalt = false;
+    if (!Halting.count(F) || alwaysHalts(*F, Halting, CallsHalt)) continue;
+    Halting.erase(F);
+    for (const auto *U : F->users())
+      if (const auto *CB = dyn_cast<CallBase>(U))
+        if (Halting.count(CB->getFunction()))
+          Worklist.push_back(CB->getFunction());
+  }
+
+  // Functions that only recurse into each other never return, but
+  // that's not the kind of halting we're looking for.
+  bool CallsHalt = false;
+  for (const auto *F : Halting)
+    alwaysHalts(*F, Halting, CallsHalt);
+  if (!CallsHalt)
+    Halting.clear();
+}
+
+PreservedAnalyses HaltPropagation::run(Module &M, ModuleAnalysisManager &MAM) {
+  auto &CG = MAM.getResult<CallGraphAnalysis>(M);
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M)
+                 .getManager();
+
+  auto markHalting = [](Function &F) {
+    F.addFnAttr(Attribute::NoReturn);
+    F.addFnAttr(Attribute::Cold);
+    NumHaltFuncs++;
+  };
+
+  unsigned NumInferred = 0;
+  // Visit callees before callers
+  for (auto I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+    SmallVector<Function*, 4> SCC;
+    for (auto *Node : *I)
+      if (auto *F = Node->getFunction())
+        if (F->hasExactDefinition() && !F->doesNotReturn())
+          SCC.push_back(F);
+    if (SCC.empty()) continue;
+
+    SmallPtrSet<const Function*, 4> Halting;
+    findHaltingFunctions(SCC, Halting);
+    for (auto *F : SCC)
+      if (Halting.count(F)) {
+        markHalting(*F);
+        ++NumInferred;
+      }
   }
+
+  // Halting blocks in other functions depend on attributes we just
+  // added, even though their CFGs didn't change.
+  auto PA = PreservedAnalyses::all();
+  PA.abandon<HaltAnalysis>();
+  unsigned NumDead = 0;
+  for (auto &F : M) {
+    if (F.isDeclaration()) continue;
+    if (NumInferred)
+      FAM.invalidate(F, PA);
+    NumDead += FAM.getResult<HaltAnalysis>(F).getNumUnreachable();
+  }
+  NumDeadBlocks += NumDead;
+
+  if (PrintPropagationSummary)
+    errs() << "Halting functions: " << NumInferred
+           << ", dead blocks: " << NumDead << "\n";
+
+  if (!NumInferred) return PreservedAnalyses::all();
+  PA.preserve<CallGraphAnalysis>();
+  PA.preserve<FunctionAnalysisManagerModuleProxy>();
+  return PA;
 }
 
 extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
@@ -65,9 +350,44 @@ llvmGetPassPluginInfo() {
     LLVM_PLUGIN_API_VERSION, "HaltAnalyzer", "v0.1",
     [](PassBuilder &PB) {
       using OptimizationLevel= typename PassBuilder::OptimizationLevel;
+      using PipelineElement = typename PassBuilder::PipelineElement;
+      PB.registerAnalysisRegistrationCallback(
+        [](FunctionAnalysisManager &FAM) {
+          FAM.registerPass([] { return HaltAnalysis(); });
+        });
+      PB.registerPipelineParsingCallback(
+        [](StringRef Name, ModulePassManager &MPM,
+           ArrayRef<PipelineElement>) {
+          if (Name == "halt-propagation") {
+            MPM.addPass(HaltPropagation());
+            return true;
+          }
+          return false;
+        });
+      PB.registerPipelineParsingCallback(
+        [](StringRef Name, FunctionPassManager &FPM,
+           ArrayRef<PipelineElement>) {
+          if (Name == "print<halt>") {
+            FPM.addPass(HaltAnalyzer(errs()));
+            return true;
+          }
+          if (Name == "halt-prune") {
+            FPM.addPass(HaltPruner());
+            return true;
+          }
+          return false;
+        });
+      // Prune the dead code before any other optimization wastes
+      // time on it
+      PB.registerPipelineStartEPCallback(
+        [](ModulePassManager &MPM, OptimizationLevel OL) {
+          if (OL.getSpeedupLevel() == 0) return;
+          MPM.addPass(HaltPropagation());
+          MPM.addPass(createModuleToFunctionPassAdaptor(HaltPruner()));
+        });
       PB.registerOptimizerLastEPCallback(
         [](ModulePassManager &MPM, OptimizationLevel OL) {
-          MPM.addPass(createModuleToFunctionPassAdaptor(HaltAnalyzer()));
+          MPM.addPass(createModuleToFunctionPassAdaptor(HaltAnalyzer(errs())));
         });
     }
   };
@@ -0,0 +1,76 @@
+#ifndef HALT_ANALYZER_H
+#define HALT_ANALYZER_H
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+class BasicBlock;
+class Function;
+class Module;
+class raw_ostream;
+
+/// Blocks that can never be reached since every path to them goes
+/// through a call to halting functions. The unwind edges of invokes
+/// are still taken.
+class HaltInfo {
+  friend class HaltAnalysis;
+
+  /// Blocks that contain calls to halting functions
+  SmallVector<BasicBlock*, 2> HaltBlocks;
+  /// Blocks that can only be reached through the `HaltBlocks`
+  SmallPtrSet<BasicBlock*, 8> UnreachableBlocks;
+
+public:
+  ArrayRef<BasicBlock*> getHaltBlocks() const { return HaltBlocks; }
+
+  bool isUnreachable(const BasicBlock *BB) const {
+    return UnreachableBlocks.count(BB);
+  }
+  size_t getNumUnreachable() const { return UnreachableBlocks.size(); }
+
+  void print(raw_ostream &OS, const Function &F) const;
+
+  /// Only kept when explicitly preserved, see the definition
+  bool invalidate(Function &F, const PreservedAnalyses &PA,
+                  FunctionAnalysisManager::Invalidator &);
+};
+
+class HaltAnalysis : public AnalysisInfoMixin<HaltAnalysis> {
+  friend AnalysisInfoMixin<HaltAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  using Result = HaltInfo;
+
+  /// Return true if \p F is one of the halting functions, or it's known
+  /// to be cold and never return (e.g. inferred by `HaltPropagation`).
+  static bool isHaltFunction(const Function &F);
+
+  HaltInfo run(Function &F, FunctionAnalysisManager &FAM);
+};
+
+/// Print the unreachable blocks
+class HaltAnalyzer : public PassInfoMixin<HaltAnalyzer> {
+  raw_ostream &OS;
+
+public:
+  explicit HaltAnalyzer(raw_ostream &OS) : OS(OS) {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+};
+
+/// Terminate blocks right after halting calls and mark the branches
+/// leading to them as cold.
+struct HaltPruner : public PassInfoMixin<HaltPruner> {
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+};
+
+/// Mark functions that always end up calling halting functions as
+/// `noreturn` and `cold`, by propagating the facts bottom-up over the
+/// call graph.
+struct HaltPropagation : public PassInfoMixin<HaltPropagation> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
+};
+} // end namespace llvm
+#endif
@@ -0,0 +1,254 @@
+#include "StrictOpt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include <utility>
+
+#define DEBUG_TYPE "strict-opt-mv"
+
+using namespace llvm;
+
+STATISTIC(NumClones, "Number of noalias clones created");
+STATISTIC(NumGuardedCalls,
+          "Number of call sites dispatched by runtime alias checks");
+
+static cl::opt<unsigned>
+SizeBudget("strict-opt-mv-size-budget", cl::init(1000),
+           cl::desc("Maximum number of instructions that can be "
+                    "duplicated by multiversioning in a module"));
+
+namespace {
+/// Byte range [Lo, Hi) accessed through a pointer argument, where both
+/// ends are offsets from the argument.
+struct AccessRange {
+  const SCEV *Lo, *Hi;
+  bool IsWritten = false;
+};
+} // end anonymous namespace
+
+/// An expression can be expanded in the entry block if it only depends
+/// on constants and function arguments.
+static bool isAvailableAtEntry(const SCEV *S) {
+  return !SCEVExprContains(S, [](const SCEV *E) {
+    if (isa<SCEVAddRecExpr>(E)) return true;
+    if (const auto *U = dyn_cast<SCEVUnknown>(E))
+      return !isa<Argument>(U->getValue()) && !isa<Constant>(U->getValue());
+    return false;
+  });
+}
+
+/// Compute the minimum and maximum value of \p S through the execution
+/// of the function.
+static Optional<std::pair<const SCEV*, const SCEV*>>
+getBounds(const SCEV *S, ScalarEvolution &SE) {
+  if (const auto *AR = dyn_cast<SCEVAddRecExpr>(S)) {
+    const auto *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+    if (!AR->isAffine() || !Step) return None;
+    const SCEV *BTC = SE.getBackedgeTakenCount(AR->getLoop());
+    if (isa<SCEVCouldNotCompute>(BTC)) return None;
+    auto StartBounds = getBounds(AR->getStart(), SE);
+    if (!StartBounds) return None;
+
+    BTC = SE.getTruncateOrZeroExtend(BTC, Step->getType());
+    const SCEV *Delta = SE.getMulExpr(Step, BTC);
+    if (Step->getAPInt().isNegative())
+      return std::make_pair(SE.getAddExpr(StartBounds->first, Delta),
+                            StartBounds->second);
+    return std::make_pair(StartBounds->first,
+                          SE.getAddExpr(StartBounds->second, Delta));
+  }
+  return std::make_pair(S, S);
+}
+
+/// Collect the range accessed through each pointer argument.
+/// Return false if any of the memory access can't be bounded.
+static bool collectAccessRanges(Function &F, ScalarEvolution &SE,
+                                MapVector<Argument*, AccessRange> &Ranges) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  DenseMap<const SCEV*, Argument*> ArgBases;
+  for (auto &Arg : F.args())
+    if (Arg.getType()->isPointerTy())
+      ArgBases[SE.getSCEV(&Arg)] = &Arg;
+
+  for (auto &I : instructions(F)) {
+    if (!I.mayReadOrWriteMemory()) continue;
+    // We can't reason about accesses made by other functions
+    if (!isa<LoadInst>(I) && !isa<StoreInst>(I)) return false;
+    if (!(isa<LoadInst>(I)? cast<LoadInst>(I).isSimple()
+                          : cast<StoreInst>(I).isSimple()))
+      return false;
+
+    Value *Ptr = getLoadStorePointerOperand(&I);
+    if (isa<AllocaInst>(getUnderlyingObject(Ptr))) continue;
+    const SCEV *PtrSCEV = SE.getSCEV(Ptr);
+    auto It = ArgBases.find(SE.getPointerBase(PtrSCEV));
+    if (It == ArgBases.end()) return false;
+    Argument *Arg = It->second;
+
+    const SCEV *Offset = SE.getMinusSCEV(PtrSCEV, It->first);
+    if (isa<SCEVCouldNotCompute>(Offset)) return false;
+    auto Bounds = getBounds(Offset, SE);
+    if (!Bounds || !isAvailableAtEntry(Bounds->first) ||
+        !isAvailableAtEntry(Bounds->second))
+      return false;
+
+    Type *AccessTy = isa<LoadInst>(I)? I.getType()
+                                     : cast<StoreInst>(I).getValueOperand()
+                                         ->getType();
+    Type *OffsetTy = Bounds->first->getType();
+    auto *AccessSize = SE.getConstant(OffsetTy,
+                                      DL.getTypeStoreSize(AccessTy));
+    const SCEV *Lo = Bounds->first,
+               *Hi = SE.getAddExpr(Bounds->second, AccessSize);
+    auto Inserted = Ranges.insert({Arg, {Lo, Hi}});
+    auto &R = Inserted.first->second;
+    if (!Inserted.second) {
+      if (R.Lo->getType() != OffsetTy) return false;
+      R.Lo = SE.getSMinExpr(R.Lo, Lo);
+      R.Hi = SE.getSMaxExpr(R.Hi, Hi);
+    }
+    R.IsWritten |= isa<StoreInst>(I);
+  }
+  return true;
+}
+
+/// Create a noalias clone of \p F and dispatch to it from the entry of
+/// \p F when none of the written ranges overlap with other ranges.
+/// Return false if there is nothing to check.
+static bool versionFunction(Function &F, ScalarEvolution &SE,
+                            const MapVector<Argument*, AccessRange> &Ranges) {
+  // Collect the pairs of argument that need a runtime check.
+  // Overlapping is fine if neither of them is written.
+  SmallVector<std::pair<Argument*, Argument*>, 4> Checks;
+  for (const auto &RA : Ranges)
+    for (const auto &RB : Ranges)
+      if (RA.first->getArgNo() < RB.first->getArgNo() &&
+          (RA.second.IsWritten || RB.second.IsWritten))
+        Checks.push_back({RA.first, RB.first});
+  if (Checks.empty()) return false;
+
+  // Fast path
+  ValueToValueMapTy VMap;
+  Function *Clone = CloneFunction(&F, VMap);
+  Clone->setName(F.getName() + ".noalias");
+  Clone->setLinkage(GlobalValue::InternalLinkage);
+  for (const auto &R : Ranges)
+    Clone->getArg(R.first->getArgNo())->addAttr(Attribute::NoAlias);
+
+  // Build the checks after static allocas
+  BasicBlock &Entry = F.getEntryBlock();
+  auto InsertPt = Entry.getFirstInsertionPt();
+  while (isa<AllocaInst>(*InsertPt)) ++InsertPt;
+
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  SCEVExpander Expander(SE, DL, "strict.mv");
+  IRBuilder<> Builder(&*InsertPt);
+  auto expandBound = [&](Argument *Arg, const SCEV *Offset) -> Value* {
+    Type *IntPtrTy = DL.getIntPtrType(Arg->getType());
+    auto *Base = SE.getPtrToIntExpr(SE.getSCEV(Arg), IntPtrTy);
+    auto *Addr = SE.getAddExpr(Base,
+                               SE.getNoopOrSignExtend(Offset, IntPtrTy));
+    return Expander.expandCodeFor(Addr, IntPtrTy, &*InsertPt);
+  };
+  DenseMap<Argument*, std::pair<Value*, Value*>> Bounds;
+  for (const auto &R : Ranges)
+    Bounds[R.first] = {expandBound(R.first, R.second.Lo),
+                       expandBound(R.first, R.second.Hi)};
+
+  Value *NoOverlap = nullptr;
+  for (const auto &C : Checks) {
+    auto &A = Bounds[C.first], &B = Bounds[C.second];
+    // A.Hi <= B.Lo || B.Hi <= A.Lo
+    auto *Disjoint = Builder.CreateOr(
+                       Builder.CreateICmpULE(A.second, B.first),
+                       Builder.CreateICmpULE(B.second, A.first),
+                       "strict.mv.disjoint");
+    NoOverlap = NoOverlap? Builder.CreateAnd(NoOverlap, Disjoint) : Disjoint;
+  }
+
+  // Split the entry block and jump to the fast path if all checks passed
+  auto *SlowBB = SplitBlock(&Entry, &*Builder.GetInsertPoint());
+  SlowBB->setName("strict.mv.slow");
+  auto *FastBB = BasicBlock::Create(F.getContext(), "strict.mv.fast", &F,
+                                    SlowBB);
+  Entry.getTerminator()->eraseFromParent();
+  BranchInst::Create(FastBB, SlowBB, NoOverlap, &Entry);
+
+  Builder.SetInsertPoint(FastBB);
+  SmallVector<Value*, 4> Args;
+  for (auto &Arg : F.args())
+    Args.push_back(&Arg);
+  auto *Call = Builder.CreateCall(Clone, Args);
+  Call->setTailCall();
+  if (F.getReturnType()->isVoidTy())
+    Builder.CreateRetVoid();
+  else
+    Builder.CreateRet(Call);
+  return true;
+}
+
+PreservedAnalyses
+StrictOptMultiVersioning::run(Module &M, ModuleAnalysisManager &MAM) {
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M)
+                 .getManager();
+
+  unsigned Budget = SizeBudget;
+  SmallVector<Function*, 8> Candidates;
+  for (auto &F : M) {
+    if (F.isDeclaration() || F.hasOptNone() || F.isVarArg()) continue;
+    unsigned NumPtrArgs = llvm::count_if(F.args(), [](const Argument &A) {
+                            return A.getType()->isPointerTy() &&
+                                   !A.hasNoAliasAttr();
+                          });
+    if (NumPtrArgs >= 2)
+      Candidates.push_back(&F);
+  }
+
+  bool Modified = false;
+  for (auto *F : Candidates) {
+    unsigned Size = F->getInstructionCount();
+    if (Size > Budget) {
+      LLVM_DEBUG(dbgs() << "Skip " << F->getName()
+                        << ": out of size budget\n");
+      continue;
+    }
+
+    auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(*F);
+    MapVector<Argument*, AccessRange> Ranges;
+    if (!collectAccessRanges(*F, SE, Ranges)) {
+      LLVM_DEBUG(dbgs() << "Skip " << F->getName()
+                        << ": unbounded memory accesses\n");
+      continue;
+    }
+    if (!versionFunction(*F, SE, Ranges)) continue;
+
+    LLVM_DEBUG(dbgs() << "Created noalias clone for " << F->getName()
+                      << "\n");
+    Budget -= Size;
+    NumClones++;
+    NumGuardedCalls += llvm::count_if(F->users(), [](const User *U) {
+                         return isa<CallBase>(U);
+                       });
+    FAM.invalidate(*F, PreservedAnalyses::none());
+    Modified = true;
+  }
+
+  return Modified? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
@@ -1,14 +1,39 @@
 #include "StrictOpt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Attributes.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
+#define DEBUG_TYPE "strict-opt"
+
 using namespace llvm;
 
+STATISTIC(NumNoAliasArgs, "Number of arguments inferred as noalias");
+
+static cl::opt<bool>
+BlanketNoAlias("strict-opt-blanket", cl::init(false),
+               cl::desc("Attach noalias to all pointer arguments without "
+                        "any proof (unsound)"));
+
+static cl::opt<bool>
+MultiVersioning("strict-opt-mv", cl::init(true),
+                cl::desc("Create noalias clones guarded by runtime checks "
+                         "for arguments that can't be proven noalias"));
+
 PreservedAnalyses StrictOpt::run(Function &F, FunctionAnalysisManager &FAM) {
   bool Modified = false;
   for (auto &Arg : F.args()) {
@@ -27,14 +52,144 @@ PreservedAnalyses StrictOpt::run(Function &F, FunctionAnalysisManager &FAM) {
   return PA;
 }
 
+namespace {
+/// Treat the pointer as not captured if the only "capturing" use is
+/// passing it as the `ArgNo`-th argument of `Callee`, whose argument is
+/// known to be not captured within the callee.
+struct CallArgCaptureTracker : public CaptureTracker {
+  const Function *Callee;
+  unsigned ArgNo;
+  bool Captured = false;
+
+  CallArgCaptureTracker(const Function *Callee, unsigned ArgNo)
+    : Callee(Callee), ArgNo(ArgNo) {}
+
+  void tooManyUses() override { Captured = true; }
+
+  bool captured(const Use *U) override {
+    if (const auto *CB = dyn_cast<CallBase>(U->getUser()))
+      if (CB->getCalledFunction() == Callee && CB->isArgOperand(U) &&
+          CB->getArgOperandNo(U) == ArgNo)
+        return false;
+    Captured = true;
+    return true;
+  }
+};
+} // end anonymous namespace
+
+/// Whether all the callers of \p F are visible to us
+static bool hasOnlyKnownCallSites(const Function &F) {
+  if (F.isDeclaration() || !F.hasLocalLinkage() || F.isVarArg())
+    return false;
+  return llvm::all_of(F.uses(), [&](const Use &U) {
+    const auto *CB = dyn_cast<CallBase>(U.getUser());
+    return CB && CB->isCallee(&U) &&
+           CB->getFunctionType() == F.getFunctionType();
+  });
+}
+
+/// Check if the `ArgNo`-th argument at call site \p CB points to an
+/// allocation that is distinct from all other pointer arguments and never
+/// escapes from the caller.
+static bool isDistinctAllocation(const CallBase &CB, unsigned ArgNo) {
+  const Value *Obj = getUnderlyingObject(CB.getArgOperand(ArgNo));
+  // Note that noalias on a caller's argument was either written by users
+  // or inferred earlier, since callers are always visited first.
+  bool IsAllocation = isa<AllocaInst>(Obj) || isNoAliasCall(Obj);
+  if (const auto *A = dyn_cast<Argument>(Obj))
+    IsAllocation = A->hasNoAliasAttr();
+  if (!IsAllocation) return false;
+
+  for (unsigned i = 0, N = CB.arg_size(); i != N; ++i) {
+    if (i == ArgNo) continue;
+    const Value *Other = CB.getArgOperand(i);
+    if (Other->getType()->isPointerTy() && getUnderlyingObject(Other) == Obj)
+      return false;
+  }
+
+  CallArgCaptureTracker Tracker(CB.getCalledFunction(), ArgNo);
+  PointerMayBeCaptured(Obj, &Tracker);
+  return !Tracker.Captured;
+}
+
+static bool inferNoAliasArgs(Function &F) {
+  if (!hasOnlyKnownCallSites(F)) return false;
+
+  bool Modified = false;
+  for (auto &Arg : F.args()) {
+    if (!Arg.getType()->isPointerTy() || Arg.hasNoAliasAttr())
+      continue;
+    // If the callee captures the argument, the callers can't
+    // guarantee anything even if they pass in distinct allocations.
+    if (PointerMayBeCaptured(&Arg, /*ReturnCaptures=*/true,
+                             /*StoreCaptures=*/true))
+      continue;
+    unsigned ArgNo = Arg.getArgNo();
+    if (llvm::all_of(F.users(), [ArgNo](const User *U) {
+                                  return isDistinctAllocation(
+                                           *cast<CallBase>(U), ArgNo);
+                                })) {
+      LLVM_DEBUG(dbgs() << "Inferred noalias on argument " << ArgNo
+                        << " of " << F.getName() << "\n");
+      Arg.addAttr(Attribute::NoAlias);
+      NumNoAliasArgs++;
+      Modified = true;
+    }
+  }
+  return Modified;
+}
+
+PreservedAnalyses StrictOptIPO::run(Module &M, ModuleAnalysisManager &MAM) {
+  auto &CG = MAM.getResult<CallGraphAnalysis>(M);
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M)
+                 .getManager();
+
+  // `scc_iterator` visits callees before callers. But the facts flow from
+  // callers to callees here, so we need to visit them in the reverse order.
+  SmallVector<SmallVector<Function*, 2>, 16> SCCs;
+  for (auto I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+    SCCs.emplace_back();
+    for (auto *Node : *I)
+      if (auto *F = Node->getFunction())
+        SCCs.back().push_back(F);
+  }
+
+  // This transformation only affects alias analysis, so only those
+  // results are invalidated.
+  auto FuncPA = PreservedAnalyses::all();
+  FuncPA.abandon<AAManager>();
+
+  bool Modified = false;
+  SmallVector<Function*, 2> ModifiedFuncs;
+  for (auto &SCC : llvm::reverse(SCCs)) {
+    ModifiedFuncs.clear();
+    for (auto *F : SCC)
+      if (inferNoAliasArgs(*F))
+        ModifiedFuncs.push_back(F);
+    // Invalidate once per SCC instead of once per function or argument
+    for (auto *F : ModifiedFuncs)
+      FAM.invalidate(*F, FuncPA);
+    Modified |= !ModifiedFuncs.empty();
+  }
+
+  if (!Modified)
+    return PreservedAnalyses::all();
+  // Function analyses were already taken care of
+  PreservedAnalyses PA;
+  PA.preserveSet<AllAnalysesOn<Function>>();
+  PA.preserve<FunctionAnalysisManagerModuleProxy>();
+  PA.preserve<CallGraphAnalysis>();
+  return PA;
+}
+
 extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
 llvmGetPassPluginInfo() {
   return {
     LLVM_PLUGIN_API_VERSION, "StrictOpt", "v0.1",
     [](PassBuilder &PB) {
-#ifdef STRICT_OPT_USE_PIPELINE_PARSER
       // Use opt's `--passes` textual pipeline description to trigger
-      // StrictOpt
+      // StrictOpt, which is always available, e.g. to time the passes
+      // on their own
       using PipelineElement = typename PassBuilder::PipelineElement;
       PB.registerPipelineParsingCallback(
         [](StringRef Name, FunctionPassManager &FPM, ArrayRef<PipelineElement>){
@@ -44,17 +199,39 @@ llvmGetPassPluginInfo() {
           }
           return false;
         });
-#else
+      PB.registerPipelineParsingCallback(
+        [](StringRef Name, ModulePassManager &MPM, ArrayRef<PipelineElement>){
+          if (Name == "strict-opt-ipo") {
+            MPM.addPass(StrictOptIPO());
+            return true;
+          }
+          if (Name == "strict-opt-mv") {
+            MPM.addPass(StrictOptMultiVersioning());
+            return true;
+          }
+          return false;
+        });
+#ifndef STRICT_OPT_USE_PIPELINE_PARSER
       // Run StrictOpt before other optimizations when the optimization
       // level is at least -O2
       using OptimizationLevel= typename PassBuilder::OptimizationLevel;
       PB.registerPipelineStartEPCallback(
         [](ModulePassManager &MPM, OptimizationLevel OL) {
-          if (OL.getSpeedupLevel() >= 2)
+          if (OL.getSpeedupLevel() < 2) return;
+          if (BlanketNoAlias)
             // Since `PassBuilder::registerPipelineStartEPCallback`
             // only accept ModulePass, we need an adapter to make
             // it work.
             MPM.addPass(createModuleToFunctionPassAdaptor(StrictOpt()));
+          else
+            MPM.addPass(StrictOptIPO());
+        });
+      // Multiversioning relies on ScalarEvolution, so it needs to run
+      // after SROA promoted the induction variables.
+      PB.registerPipelineEarlySimplificationEPCallback(
+        [](ModulePassManager &MPM, OptimizationLevel OL) {
+          if (OL.getSpeedupLevel() >= 3 && MultiVersioning)
+            MPM.addPass(StrictOptMultiVersioning());
         });
 #endif
     }
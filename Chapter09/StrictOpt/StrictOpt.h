@@ -4,9 +4,24 @@
 
 namespace llvm {
 class Function;
+class Module;
 
+/// Blindly attach `noalias` to every pointer argument.
 struct StrictOpt : public PassInfoMixin<StrictOpt> {
   PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
 };
+
+/// Only attach `noalias` to a pointer argument when every call site
+/// passes in a distinct, non-escaping allocation.
+struct StrictOptIPO : public PassInfoMixin<StrictOptIPO> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
+};
+
+/// Clone functions into a `noalias` fast path, which is selected at the
+/// function entry by runtime checks on the accessed pointer ranges.
+struct StrictOptMultiVersioning
+  : public PassInfoMixin<StrictOptMultiVersioning> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
+};
 } // end namspace llvm
 #endif
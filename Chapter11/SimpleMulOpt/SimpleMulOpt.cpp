@@ -1,7 +1,15 @@
 #include "llvm/ADT/APInt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/Function.h"
@@ -9,99 +17,548 @@
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/PassManager.h"
+#include "llvm/IR/PatternMatch.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/BranchProbability.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
-#include <string>
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include <algorithm>
 
 #define DEBUG_TYPE "simple-mul-opt"
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
 
 STATISTIC(NumMul, "Number of multiplications processed");
+STATISTIC(NumMulReduced,
+          "Number of multiplications lowered into shift/add/sub sequences");
+STATISTIC(NumDivReduced,
+          "Number of divisions or remainders by power of two lowered");
+STATISTIC(NumMulRecurrences,
+          "Number of multiplications of induction variables turned into "
+          "additive recurrences");
+STATISTIC(NumColdSkipped,
+          "Number of replacements skipped because they are in cold blocks");
+
+static cl::opt<unsigned>
+MaxMulTerms("simple-mul-max-terms", cl::init(8), cl::Hidden,
+            cl::desc("Maximum number of shifted terms a multiplication "
+                     "can be decomposed into"));
+
+static cl::opt<unsigned>
+MulCostCap("simple-mul-cost-cap", cl::init(0), cl::Hidden,
+           cl::desc("Override the cost of multiplication reported by "
+                    "TargetTransformInfo. Zero means no override"));
+
+static cl::opt<bool>
+LoopAware("simple-mul-loop-aware", cl::init(false),
+          cl::desc("Turn multiplications of induction variables by "
+                   "constant into additive recurrences"));
+
+static cl::opt<unsigned>
+ColdFreqPercent("simple-mul-cold-freq", cl::init(10), cl::Hidden,
+                cl::desc("Without profile, blocks estimated to run less "
+                         "often than this percentage of the function entry "
+                         "are cold and don't grow. Zero means none is cold"));
 
 namespace {
+enum class InsertionPoint { PipelineStart, VectorizerStart, OptimizerLast };
+} // end anonymous namespace
+
+static cl::opt<InsertionPoint>
+MulOptEP("simple-mul-ep", cl::init(InsertionPoint::PipelineStart),
+         cl::desc("Where the pass is inserted in the -O3 pipeline"),
+         cl::values(clEnumValN(InsertionPoint::PipelineStart,
+                               "pipeline-start",
+                               "Before any other optimization"),
+                    clEnumValN(InsertionPoint::VectorizerStart,
+                               "vectorizer-start",
+                               "After the loop optimizations, before "
+                               "the vectorizers"),
+                    clEnumValN(InsertionPoint::OptimizerLast,
+                               "optimizer-last",
+                               "At the end of the pipeline")));
+
+namespace {
+/// A multiplication by constant written as a sum of shifted terms:
+///   X * C == sum( +/- (X << Shift) )
+/// The terms are stored from the most to the least significant one.
+struct MulDecomposition {
+  struct Term {
+    unsigned Shift;
+    bool Negative;
+  };
+  SmallVector<Term, 4> Terms;
+
+  /// Plain binary representation, one positive term per set bit.
+  static MulDecomposition fromBinary(const APInt &C);
+  /// Non-adjacent form (a.k.a canonical signed digit), which has the
+  /// minimal number of non-zero digits among all signed-digit forms.
+  static MulDecomposition fromNAF(const APInt &C);
+
+  size_t size() const { return Terms.size(); }
+
+  void print(raw_ostream &OS) const;
+};
+
 struct SimpleMulOpt : public PassInfoMixin<SimpleMulOpt> {
   PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
 };
 } // end anonymous namespace
 
+MulDecomposition MulDecomposition::fromBinary(const APInt &C) {
+  MulDecomposition D;
+  for (unsigned i = C.getBitWidth(); i > 0; --i)
+    if (C[i - 1])
+      D.Terms.push_back({i - 1, false});
+  return D;
+}
+
+MulDecomposition MulDecomposition::fromNAF(const APInt &C) {
+  MulDecomposition D;
+  // Everything is computed in modulo 2^BitWidth: the recoding of the
+  // top bits can carry into position BitWidth, but X << BitWidth is zero
+  // there (and poison in IR), so only the lower positions are visited.
+  unsigned BitWidth = C.getBitWidth();
+  APInt V = C;
+  for (unsigned Pos = 0; Pos < BitWidth && !V.isNullValue();
+       ++Pos, V.lshrInPlace(1)) {
+    if (!V[0]) continue;
+    // Pick the digit (+1 or -1) that makes the next bit zero
+    if (V[1]) {
+      D.Terms.push_back({Pos, true});
+      ++V;
+    } else {
+      D.Terms.push_back({Pos, false});
+      --V;
+    }
+  }
+  std::reverse(D.Terms.begin(), D.Terms.end());
+  return D;
+}
+
+void MulDecomposition::print(raw_ostream &OS) const {
+  for (unsigned i = 0; i < Terms.size(); ++i) {
+    const auto &T = Terms[i];
+    if (i > 0)
+      OS << (T.Negative? " - " : " + ");
+    else if (T.Negative)
+      OS << "-";
+    if (T.Shift) OS << "(x << " << T.Shift << ")";
+    else OS << "x";
+  }
+}
+
+/// Estimate the cost of materializing \p D
+static InstructionCost getDecompositionCost(const MulDecomposition &D,
+                                            Type *Ty,
+                                            const TargetTransformInfo &TTI) {
+  using TTI_ = TargetTransformInfo;
+  const auto CostKind = TTI_::TCK_RecipThroughput;
+  InstructionCost Cost = 0;
+  for (const auto &T : D.Terms)
+    if (T.Shift)
+      Cost += TTI.getArithmeticInstrCost(Instruction::Shl, Ty, CostKind,
+                                         TTI_::OK_AnyValue,
+                                         TTI_::OK_UniformConstantValue);
+  // One addition or subtraction between each adjacent terms, plus a
+  // negation when there is no positive term to start with.
+  unsigned NumAddSub = D.size() - 1;
+  if (llvm::all_of(D.Terms, [](const MulDecomposition::Term &T) {
+                              return T.Negative;
+                            }))
+    ++NumAddSub;
+  if (NumAddSub)
+    Cost += TTI.getArithmeticInstrCost(Instruction::Add, Ty, CostKind) *
+            NumAddSub;
+  return Cost;
+}
+
+static Value *emitDecomposition(IRBuilder<> &Builder, Value *Base,
+                                const MulDecomposition &D) {
+  auto shifted = [&](const MulDecomposition::Term &T) -> Value* {
+    return T.Shift? Builder.CreateShl(Base, T.Shift) : Base;
+  };
+
+  // Start from a positive term if there is any, so that we don't
+  // need an extra negation.
+  unsigned StartIdx = 0;
+  while (StartIdx < D.size() && D.Terms[StartIdx].Negative)
+    ++StartIdx;
+  Value *Result;
+  if (StartIdx == D.size()) {
+    StartIdx = 0;
+    Result = Builder.CreateNeg(shifted(D.Terms.front()));
+  } else {
+    Result = shifted(D.Terms[StartIdx]);
+  }
+
+  for (unsigned i = 0; i < D.size(); ++i) {
+    if (i == StartIdx) continue;
+    const auto &T = D.Terms[i];
+    auto *Term = shifted(T);
+    Result = T.Negative? Builder.CreateSub(Result, Term)
+                       : Builder.CreateAdd(Result, Term);
+  }
+  return Result;
+}
+
+/// Lower division or remainder by a (positive) power of two.
+/// Return nullptr if it's not applicable.
+static Value *emitDivRemByPowerOf2(IRBuilder<> &Builder, BinaryOperator *I,
+                                   Value *Base, const APInt &C) {
+  unsigned BitWidth = C.getBitWidth();
+  unsigned ShiftAmt = C.logBase2();
+  switch (I->getOpcode()) {
+  case Instruction::UDiv:
+    return Builder.CreateLShr(Base, ShiftAmt, "", I->isExact());
+  case Instruction::URem:
+    return Builder.CreateAnd(Base, C - 1);
+  case Instruction::SDiv: {
+    if (ShiftAmt == 0) return Base;
+    if (I->isExact())
+      return Builder.CreateAShr(Base, ShiftAmt, "", /*isExact=*/true);
+    // Round towards zero: add (2^ShiftAmt - 1) to negative dividends
+    // before shifting.
+    auto *Sign = Builder.CreateAShr(Base, BitWidth - 1);
+    auto *Bias = Builder.CreateLShr(Sign, BitWidth - ShiftAmt);
+    auto *Biased = Builder.CreateAdd(Base, Bias);
+    return Builder.CreateAShr(Biased, ShiftAmt);
+  }
+  default:
+    return nullptr;
+  }
+}
+
+/// Estimate the cost of the sequence created by `emitDivRemByPowerOf2`
+static InstructionCost getDivRemCost(BinaryOperator *I,
+                                     const TargetTransformInfo &TTI) {
+  using TTI_ = TargetTransformInfo;
+  auto getCost = [&](unsigned Opcode) {
+    return TTI.getArithmeticInstrCost(Opcode, I->getType(),
+                                      TTI_::TCK_RecipThroughput,
+                                      TTI_::OK_AnyValue,
+                                      TTI_::OK_UniformConstantValue);
+  };
+  switch (I->getOpcode()) {
+  case Instruction::UDiv:
+    return getCost(Instruction::LShr);
+  case Instruction::URem:
+    return getCost(Instruction::And);
+  case Instruction::SDiv:
+    if (I->isExact())
+      return getCost(Instruction::AShr);
+    return getCost(Instruction::AShr) * 2 + getCost(Instruction::LShr) +
+           TTI.getArithmeticInstrCost(Instruction::Add, I->getType(),
+                                      TTI_::TCK_RecipThroughput);
+  default:
+    return InstructionCost::getInvalid();
+  }
+}
+
+static void printDivRemSequence(raw_ostream &OS, BinaryOperator *I,
+                                const APInt &C) {
+  switch (I->getOpcode()) {
+  case Instruction::UDiv:
+    OS << "x >>u " << C.logBase2();
+    break;
+  case Instruction::URem:
+    OS << "x & " << (C - 1);
+    break;
+  case Instruction::SDiv:
+    OS << "x >>s " << C.logBase2();
+    if (!I->isExact())
+      OS << " (rounded towards zero)";
+    break;
+  default:
+    llvm_unreachable("Unsupported opcode");
+  }
+}
+
+/// Return the loop of which \p Base is an induction variable stepping by
+/// a constant, written into \p Step, if \p I is in that loop. Only loops
+/// with a preheader and a single latch are considered.
+static Loop *matchInduction(Value *Base, Instruction *I, LoopInfo &LI,
+                            ScalarEvolution &SE, APInt &Step) {
+  auto *IV = dyn_cast<PHINode>(Base);
+  if (!IV || !IV->getType()->isIntegerTy())
+    return nullptr;
+  Loop *L = LI.getLoopFor(IV->getParent());
+  if (!L || L->getHeader() != IV->getParent() || !L->contains(I) ||
+      !L->getLoopPreheader() || !L->getLoopLatch())
+    return nullptr;
+  auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(IV));
+  if (!AR || AR->getLoop() != L || !AR->isAffine())
+    return nullptr;
+  auto *StepC = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+  if (!StepC)
+    return nullptr;
+  Step = StepC->getAPInt();
+  return L;
+}
+
+/// Create an induction variable of \p L that equals \p IV * \p C in
+/// every iteration: it starts from Start * C, computed once in the
+/// preheader, and steps by Step * C.
+static PHINode *emitMulRecurrence(PHINode *IV, Loop *L, const APInt &C,
+                                  const APInt &Step) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  Type *Ty = IV->getType();
+
+  IRBuilder<> Builder(Preheader->getTerminator());
+  Value *Start = Builder.CreateMul(IV->getIncomingValueForBlock(Preheader),
+                                   ConstantInt::get(Ty, C), "mul.iv.start");
+  Builder.SetInsertPoint(L->getHeader(), L->getHeader()->begin());
+  PHINode *NewIV = Builder.CreatePHI(Ty, 2, "mul.iv");
+  // No no-wrap flags: the last addition computes the product for an
+  // iteration that never runs, which may overflow
+  Builder.SetInsertPoint(Latch->getTerminator());
+  Value *Next = Builder.CreateAdd(NewIV, ConstantInt::get(Ty, Step * C),
+                                  "mul.iv.next");
+  NewIV->addIncoming(Start, Preheader);
+  NewIV->addIncoming(Next, Latch);
+  return NewIV;
+}
+
+static void emitReplacementRemark(OptimizationRemarkEmitter &ORE,
+                                  BinaryOperator *I, StringRef Sequence,
+                                  InstructionCost Savings) {
+  Optional<int64_t> SavingsVal = Savings.getValue();
+  ORE.emit(OptimizationRemark(DEBUG_TYPE, "Replacement", I)
+           << "Replacing " << ore::NV("Original", I)
+           << " with " << ore::NV("Sequence", Sequence)
+           << ", saving an estimated "
+           << ore::NV("Savings", SavingsVal? *SavingsVal : 0) << " cycles");
+}
+
 PreservedAnalyses
 SimpleMulOpt::run(Function &F, FunctionAnalysisManager &FAM) {
   auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+  auto &TTI = FAM.getResult<TargetIRAnalysis>(F);
+  // Only build remarks if someone is listening
+  const bool EmitRemarks = ORE.allowExtraAnalysis(DEBUG_TYPE);
 
-  struct Replacement {
-    Instruction *I;
-    Value *Base;
-    APInt ShiftAmt;
+  LoopInfo *LI = nullptr;
+  ScalarEvolution *SE = nullptr;
+  if (LoopAware) {
+    LI = &FAM.getResult<LoopAnalysis>(F);
+    SE = &FAM.getResult<ScalarEvolutionAnalysis>(F);
+  }
+  // Recurrences already created for (induction variable, constant)
+  DenseMap<std::pair<Value*, Value*>, PHINode*> Recurrences;
+
+  // Replacements longer than the original instruction are only worth
+  // it where the code runs often: not cold according to the profile,
+  // if there is one, otherwise according to the static estimation.
+  auto *PSI = FAM.getResult<ModuleAnalysisManagerFunctionProxy>(F)
+                .getCachedResult<ProfileSummaryAnalysis>(*F.getParent());
+  BlockFrequencyInfo *BFI = nullptr;
+  auto isColdBlock = [&](BasicBlock *BB) {
+    if (F.hasMinSize())
+      return true;
+    if (!ColdFreqPercent && !(PSI && PSI->hasProfileSummary()))
+      return false;
+    // Computed on demand, the control flow never changes
+    if (!BFI)
+      BFI = &FAM.getResult<BlockFrequencyAnalysis>(F);
+    if (PSI && PSI->hasProfileSummary())
+      return PSI->isColdBlock(BB, BFI);
+    auto Threshold = BlockFrequency(BFI->getEntryFreq()) *
+                     BranchProbability(std::min(ColdFreqPercent.getValue(),
+                                                100U), 100);
+    return BFI->getBlockFreq(BB) < Threshold;
   };
-  SmallVector<Replacement, 2> Worklist;
-
-  for (auto &I : instructions(F)) {
-    if (auto *BinOp = dyn_cast<BinaryOperator>(&I))
-      if (BinOp->getOpcode() == Instruction::Mul) {
-        NumMul++;
-        auto *LHS = BinOp->getOperand(0),
-             *RHS = BinOp->getOperand(1);
-        LLVM_DEBUG(dbgs() << "Found a multiplication instruction ");
-        LLVM_DEBUG(LHS->printAsOperand(dbgs() << " with LHS: "));
-        LLVM_DEBUG(RHS->printAsOperand(dbgs() << " and RHS: "));
-        LLVM_DEBUG(dbgs() << "\n");
-
-        // Neither of them is constant
-        if (!isa<ConstantInt>(LHS) && !isa<ConstantInt>(RHS)) {
-          ORE.emit([&]() {
-            std::string InstStr;
-            raw_string_ostream SS(InstStr);
-            I.print(SS);
-            return OptimizationRemarkMissed(DEBUG_TYPE, "NoConstOperand", &I)
-                   << "Instruction"
-                   << ore::NV("Inst", SS.str())
-                   << " does not contain any constant operand";
-          });
-          continue;
+  auto emitColdRemark = [&](BinaryOperator *I) {
+    NumColdSkipped++;
+    if (EmitRemarks)
+      ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "ColdBlock", I)
+               << "Keeping " << ore::NV("Inst", I)
+               << " in a cold block to save code size");
+  };
+
+  bool Changed = false;
+  // Replacements are inserted before the instruction being visited,
+  // so it's safe to rewrite in place while iterating.
+  for (auto &I : make_early_inc_range(instructions(F))) {
+    auto *BinOp = dyn_cast<BinaryOperator>(&I);
+    if (!BinOp) continue;
+    auto Opcode = BinOp->getOpcode();
+    Type *Ty = BinOp->getType();
+    Value *Base;
+    const APInt *ConstPtr;
+    Value *New = nullptr;
+    InstructionCost Savings;
+
+    if (Opcode == Instruction::Mul) {
+      NumMul++;
+      LLVM_DEBUG(dbgs() << "Found a multiplication instruction ");
+      LLVM_DEBUG(BinOp->getOperand(0)->printAsOperand(dbgs() << " with LHS: "));
+      LLVM_DEBUG(BinOp->getOperand(1)->printAsOperand(dbgs() << " and RHS: "));
+      LLVM_DEBUG(dbgs() << "\n");
+
+      // Neither of them is constant (or splat of constant)
+      if (!match(BinOp, m_c_Mul(m_Value(Base), m_APInt(ConstPtr)))) {
+        if (EmitRemarks)
+          ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "NoConstOperand", &I)
+                   << "Instruction " << ore::NV("Inst", &I)
+                   << " does not contain any constant operand");
+        continue;
+      }
+      const APInt &Const = *ConstPtr;
+      // Leave the trivial cases to InstCombine
+      if (Const.isNullValue() || Const.isOneValue())
+        continue;
+
+      auto Decomp = MulDecomposition::fromBinary(Const);
+      auto NAF = MulDecomposition::fromNAF(Const);
+      if (NAF.size() < Decomp.size())
+        Decomp = std::move(NAF);
+
+      // The decomposed sequence should never cost more than the
+      // multiplication itself
+      InstructionCost MulCost = MulCostCap.getValue();
+      if (!MulCostCap)
+        MulCost = TTI.getArithmeticInstrCost(
+                    Instruction::Mul, Ty,
+                    TargetTransformInfo::TCK_RecipThroughput,
+                    TargetTransformInfo::OK_AnyValue,
+                    TargetTransformInfo::OK_UniformConstantValue);
+      auto SeqCost = getDecompositionCost(Decomp, Ty, TTI);
+      // Shifting is always favorable over multiplication by power of two
+      bool IsSingleShift = Decomp.size() == 1 && !Decomp.Terms[0].Negative;
+      auto *ConstV = BinOp->getOperand(BinOp->getOperand(0) == Base);
+      if (!IsSingleShift && isColdBlock(BinOp->getParent())) {
+        emitColdRemark(BinOp);
+        continue;
+      }
+
+      // A multiplication of an induction variable only needs an addition
+      // per iteration, on a second induction variable. Not worth the
+      // register for a single shift.
+      APInt Step;
+      Loop *L = nullptr;
+      if (LoopAware && !IsSingleShift)
+        L = matchInduction(Base, BinOp, *LI, *SE, Step);
+      if (L) {
+        auto *IV = cast<PHINode>(Base);
+        PHINode *&NewIV = Recurrences[{IV, ConstV}];
+        if (!NewIV) {
+          NewIV = emitMulRecurrence(IV, L, Const, Step);
+          Savings = MulCost - TTI.getArithmeticInstrCost(
+                                Instruction::Add, Ty,
+                                TargetTransformInfo::TCK_RecipThroughput);
+        } else {
+          Savings = MulCost;
         }
-        auto *ConstV = isa<ConstantInt>(LHS)? LHS : RHS;
-        auto *Base = ConstV == LHS? RHS : LHS;
-        const APInt &Const = cast<ConstantInt>(ConstV)->getValue();
-        // Not power of two
-        if (!Const.isPowerOf2()) {
-          ORE.emit([&]() {
-            return OptimizationRemarkMissed(DEBUG_TYPE, "ConstNotPowerOf2", &I)
-                   << "Constant operand "
-                   << Const.toString(10, false)
-                   << " is not power of two";
-          });
+        New = NewIV;
+        NumMulRecurrences++;
+
+        if (EmitRemarks) {
+          SmallString<32> SeqStr;
+          raw_svector_ostream SeqSS(SeqStr);
+          SeqSS << "an induction variable stepping by " << Step * Const;
+          emitReplacementRemark(ORE, BinOp, SeqSS.str(), Savings);
+        }
+      } else {
+        if (!IsSingleShift &&
+            (Decomp.size() > MaxMulTerms || !SeqCost.isValid() ||
+             SeqCost >= MulCost)) {
+          if (EmitRemarks) {
+            SmallString<32> SeqStr;
+            raw_svector_ostream SeqSS(SeqStr);
+            Decomp.print(SeqSS);
+            ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "NotProfitable", &I)
+                     << "Multiplying by constant "
+                     << ore::NV("Const", ConstV)
+                     << " is cheaper than its decomposition "
+                     << ore::NV("Sequence", SeqSS.str()));
+          }
           continue;
         }
-        APInt ShiftAmt(Const.getBitWidth(), Const.logBase2());
-        Worklist.push_back({&I, Base, ShiftAmt});
+
+        IRBuilder<> Builder(BinOp);
+        New = emitDecomposition(Builder, Base, Decomp);
+        Savings = MulCost - SeqCost;
+        NumMulReduced++;
+
+        if (EmitRemarks) {
+          SmallString<32> SeqStr;
+          raw_svector_ostream SeqSS(SeqStr);
+          Decomp.print(SeqSS);
+          emitReplacementRemark(ORE, BinOp, SeqSS.str(), Savings);
+        }
       }
-  }
 
-  // Replacing multiplication instructions
-  for (auto &R : Worklist) {
-    // Create new left-shifting instruction
-    IRBuilder<> Builder(R.I);
-    auto *Shl = Builder.CreateShl(R.Base, R.ShiftAmt);
-
-    ORE.emit([&]() {
-      std::string OrigInstStr, NewInstStr;
-      raw_string_ostream OrigSS(OrigInstStr),
-                         NewSS(NewInstStr);
-      R.I->print(OrigSS);
-      Shl->print(NewSS);
-      return OptimizationRemark(DEBUG_TYPE, "Replacement", R.I)
-             << "Replacing" << ore::NV("Original", OrigSS.str())
-             << " with" << ore::NV("New", NewSS.str());
-    });
-
-    R.I->replaceAllUsesWith(Shl);
-    R.I->eraseFromParent();
+    } else if (Opcode == Instruction::UDiv || Opcode == Instruction::URem ||
+               Opcode == Instruction::SDiv) {
+      if (!match(BinOp->getOperand(1), m_APInt(ConstPtr)))
+        continue;
+      Base = BinOp->getOperand(0);
+      const APInt &Const = *ConstPtr;
+      if (!Const.isPowerOf2() ||
+          (Opcode == Instruction::SDiv && Const.isNegative()))
+        continue;
+      auto DivCost = TTI.getArithmeticInstrCost(
+                       Opcode, Ty,
+                       TargetTransformInfo::TCK_RecipThroughput,
+                       TargetTransformInfo::OK_AnyValue,
+                       TargetTransformInfo::OK_UniformConstantValue);
+      Savings = DivCost - getDivRemCost(BinOp, TTI);
+      if (!Savings.isValid() || Savings < 0) {
+        if (EmitRemarks)
+          ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "NotProfitable", &I)
+                   << "Shifting sequence is more expensive than "
+                   << ore::NV("Opcode", BinOp->getOpcodeName()));
+        continue;
+      }
+      // Only the rounding of signed division takes more instructions
+      if (Opcode == Instruction::SDiv && !BinOp->isExact() &&
+          isColdBlock(BinOp->getParent())) {
+        emitColdRemark(BinOp);
+        continue;
+      }
+
+      IRBuilder<> Builder(BinOp);
+      New = emitDivRemByPowerOf2(Builder, BinOp, Base, Const);
+      NumDivReduced++;
+
+      if (EmitRemarks) {
+        SmallString<32> SeqStr;
+        raw_svector_ostream SeqSS(SeqStr);
+        printDivRemSequence(SeqSS, BinOp, Const);
+        emitReplacementRemark(ORE, BinOp, SeqSS.str(), Savings);
+      }
+    }
+
+    if (!New) continue;
+    // Recurrences are shared, they keep a name of their own. Identities
+    // like `sdiv X, 1` fold to the operand itself, which keeps its name.
+    if (New != Base && !New->hasName())
+      New->takeName(BinOp);
+    BinOp->replaceAllUsesWith(New);
+    BinOp->eraseFromParent();
+    Changed = true;
   }
 
-  return Worklist.empty()? PreservedAnalyses::all() : PreservedAnalyses::none();
+  if (!Changed)
+    return PreservedAnalyses::all();
+  // We never touch the control flow, only add induction variables
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  return PA;
+}
+
+/// Add the pass into a default pipeline
+static void addToPipeline(FunctionPassManager &FPM) {
+  // Recurrences need preheaders, which SimplifyCFG may have removed since
+  // the last loop passes
+  if (LoopAware)
+    FPM.addPass(LoopSimplifyPass());
+  FPM.addPass(SimpleMulOpt());
 }
 
 extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
@@ -111,10 +568,36 @@ llvmGetPassPluginInfo() {
     [](PassBuilder &PB) {
       using OptimizationLevel= typename PassBuilder::OptimizationLevel;
       using PipelineElement = typename PassBuilder::PipelineElement;
+      // Most of the constant multiplications, like the scaled induction
+      // variables and the address arithmetic, only show up after
+      // InstCombine and the loop passes, hence the later insertion points.
+      // The profile summary tells the cold blocks apart.
       PB.registerPipelineStartEPCallback(
         [](ModulePassManager &MPM, OptimizationLevel OL) {
-          if (OL.getSpeedupLevel() > 2)
-            MPM.addPass(createModuleToFunctionPassAdaptor(SimpleMulOpt()));
+          if (OL.getSpeedupLevel() > 2 &&
+              MulOptEP == InsertionPoint::PipelineStart) {
+            MPM.addPass(RequireAnalysisPass<ProfileSummaryAnalysis, Module>());
+            FunctionPassManager FPM;
+            addToPipeline(FPM);
+            MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+          }
+        });
+      // The profile summary is already computed by the default pipelines
+      PB.registerVectorizerStartEPCallback(
+        [](FunctionPassManager &FPM, OptimizationLevel OL) {
+          if (OL.getSpeedupLevel() > 2 &&
+              MulOptEP == InsertionPoint::VectorizerStart)
+            addToPipeline(FPM);
+        });
+      PB.registerOptimizerLastEPCallback(
+        [](ModulePassManager &MPM, OptimizationLevel OL) {
+          if (OL.getSpeedupLevel() > 2 &&
+              MulOptEP == InsertionPoint::OptimizerLast) {
+            MPM.addPass(RequireAnalysisPass<ProfileSummaryAnalysis, Module>());
+            FunctionPassManager FPM;
+            addToPipeline(FPM);
+            MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+          }
         });
       PB.registerPipelineParsingCallback(
         [](StringRef Name, FunctionPassManager &FPM,
@@ -0,0 +1,12 @@
+; Folding `sdiv X, 1` to X must not rename X.
+; RUN: opt %load_simple_mul -passes='function(simple-mul-opt)' -S %s \
+; RUN:   | FileCheck %s
+
+define i32 @sdiv_one(i32 %x) {
+; CHECK-LABEL: @sdiv_one(
+; CHECK-NEXT:    [[T:%[0-9]+]] = add i32 [[X:%.*]], 3
+; CHECK-NEXT:    ret i32 [[T]]
+  %1 = add i32 %x, 3
+  %r = sdiv i32 %1, 1
+  ret i32 %r
+}
@@ -0,0 +1,15 @@
+import os
+
+import lit.formats
+
+config.name = 'SimpleMulOpt'
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = ['.ll']
+config.test_source_root = os.path.dirname(__file__)
+
+# The plugin's own options are only known to opt after -load
+config.substitutions.append(
+    ('%load_simple_mul',
+     '-load {0} -load-pass-plugin {0}'.format(config.simple_mul_plugin)))
+config.environment['PATH'] = os.pathsep.join(
+    [config.llvm_tools_dir, config.environment.get('PATH', '')])
@@ -0,0 +1,56 @@
+; The non-adjacent form of a negative power of two carries out of the top
+; bit, which must not turn into a shift by the bit width.
+; RUN: opt %load_simple_mul -passes='function(simple-mul-opt)' \
+; RUN:   -simple-mul-cost-cap=10 -S %s | FileCheck %s
+
+define i8 @neg16_i8(i8 %x) {
+; CHECK-LABEL: @neg16_i8(
+; CHECK-NEXT:    [[T:%.*]] = shl i8 [[X:%.*]], 4
+; CHECK-NEXT:    [[R:%.*]] = sub i8 0, [[T]]
+; CHECK-NEXT:    ret i8 [[R]]
+  %r = mul i8 %x, -16
+  ret i8 %r
+}
+
+; -128 is also 2^7 modulo 2^8
+define i8 @neg128_i8(i8 %x) {
+; CHECK-LABEL: @neg128_i8(
+; CHECK-NEXT:    [[R:%.*]] = shl i8 [[X:%.*]], 7
+; CHECK-NEXT:    ret i8 [[R]]
+  %r = mul i8 %x, -128
+  ret i8 %r
+}
+
+define i8 @neg48_i8(i8 %x) {
+; CHECK-LABEL: @neg48_i8(
+; CHECK-NOT:     shl i8 {{.*}}, 8
+; CHECK:         ret i8
+  %r = mul i8 %x, -48
+  ret i8 %r
+}
+
+define i32 @neg16_i32(i32 %x) {
+; CHECK-LABEL: @neg16_i32(
+; CHECK-NEXT:    [[T:%.*]] = shl i32 [[X:%.*]], 4
+; CHECK-NEXT:    [[R:%.*]] = sub i32 0, [[T]]
+; CHECK-NEXT:    ret i32 [[R]]
+  %r = mul i32 %x, -16
+  ret i32 %r
+}
+
+define i32 @neg_min_i32(i32 %x) {
+; CHECK-LABEL: @neg_min_i32(
+; CHECK-NEXT:    [[R:%.*]] = shl i32 [[X:%.*]], 31
+; CHECK-NEXT:    ret i32 [[R]]
+  %r = mul i32 %x, -2147483648
+  ret i32 %r
+}
+
+define <2 x i64> @neg16_v2i64(<2 x i64> %x) {
+; CHECK-LABEL: @neg16_v2i64(
+; CHECK-NEXT:    [[T:%.*]] = shl <2 x i64> [[X:%.*]], <i64 4, i64 4>
+; CHECK-NEXT:    [[R:%.*]] = sub <2 x i64> zeroinitializer, [[T]]
+; CHECK-NEXT:    ret <2 x i64> [[R]]
+  %r = mul <2 x i64> %x, <i64 -16, i64 -16>
+  ret <2 x i64> %r
+}